@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+
+#include "batch.h"
+#include "../vm/vm.h"
+#include "../file/file.h"
+
+#define BATCH_THREADS_MAX 256
+
+typedef struct {
+	int exitCode;		// what runFile() would have exited with - 0, 65, 70 or 74
+	uint64_t nanos;
+	char* output;		// captured stdout, NULL when the script printed nothing
+	size_t outputLength;
+	char* errors;		// captured stderr
+	size_t errorsLength;
+	bool done;			// guarded by Batch.lock
+} BatchJob;
+
+typedef struct {
+	// A worker's share of the jobs, the indices [next, end). The owner takes from the front so its jobs
+	// finish in roughly the order they are emitted, while thieves take half of what is left from the back
+	mtx_t lock;
+	int next;
+	int end;
+} WorkQueue;
+
+typedef struct Batch Batch;
+
+typedef struct {
+	Batch* batch;
+	int index;
+	WorkQueue queue;
+	FILE* output;		// scratch files the worker's VMs print into, reused for every job
+	FILE* errors;
+} Worker;
+
+struct Batch {
+	const char** paths;
+	BatchJob* jobs;
+	BatchOptions* options;
+	Worker* workers;
+	int workerCount;
+	mtx_t lock;
+	cnd_t jobDone;		// signalled whenever a job's done flag is set
+};
+
+static uint64_t nanoTime() {
+	struct timespec time;
+	timespec_get(&time, TIME_UTC);
+	return (uint64_t)time.tv_sec * 1000000000u + (uint64_t)time.tv_nsec;
+}
+
+static int takeJob(Worker* worker) {
+	// Returns the next job index for this worker, or -1 once there is nothing left to take or steal
+	WorkQueue* queue = &worker->queue;
+	mtx_lock(&queue->lock);
+	int job = queue->next < queue->end ? queue->next++ : -1;
+	mtx_unlock(&queue->lock);
+	if (job != -1) return job;
+
+	// Only one lock is ever held at a time, so two workers stealing from each other can't deadlock
+	Batch* batch = worker->batch;
+	for (int i = 1; i < batch->workerCount; i++) {
+		WorkQueue* victim = &batch->workers[(worker->index + i) % batch->workerCount].queue;
+		mtx_lock(&victim->lock);
+		int remaining = victim->end - victim->next;
+		int stolen = (remaining + 1) / 2;
+		victim->end -= stolen;
+		mtx_unlock(&victim->lock);
+		if (stolen == 0) continue;
+
+		int start = victim->end;
+		mtx_lock(&queue->lock);
+		queue->next = start + 1;
+		queue->end = start + stolen;
+		mtx_unlock(&queue->lock);
+		return start;
+	}
+	return -1;
+}
+
+static int runScript(BatchOptions* options, const char* path, FILE* output, FILE* errors) {
+	// Each script gets a VM of its own, so nothing it does can be seen by another job
+	MappedFile source;
+	if (!mapSourceFile(path, &source)) {
+		fprintf(errors, "Could not open file \"%s\".\n", path);
+		return 74;
+	}
+
+	VM vm;
+	initVM(&vm);
+	vm.output = output;
+	vm.errorOutput = errors;
+	vm.cacheDirectory = options->cacheDirectory;
+	vm.lexThreads = options->lexThreads;
+	vm.debug.printCode = options->printCode;
+	vm.debug.stressGC = options->stressGC;
+	vm.markThreads = options->markThreads;
+
+	InterpretResult result = interpret(&vm, source.bytes);
+	freeVM(&vm);
+	unmapFile(&source);
+
+	if (result == INTERPRET_COMPILE_ERROR) return 65;
+	if (result == INTERPRET_RUNTIME_ERROR) return 70;
+	return 0;
+}
+
+static void capture(FILE* file, char** bytes, size_t* length) {
+	// Copies what the job wrote and rewinds for the next one. Whatever an earlier, longer job left
+	// past the current position is never read
+	long written = ftell(file);
+	*bytes = NULL;
+	*length = 0;
+	if (written > 0 && (*bytes = (char*)malloc((size_t)written)) != NULL) {
+		rewind(file);
+		*length = fread(*bytes, 1, (size_t)written, file);
+	}
+	rewind(file);
+}
+
+static void runJob(Worker* worker, int index) {
+	Batch* batch = worker->batch;
+	BatchJob* job = &batch->jobs[index];
+	uint64_t start = nanoTime();
+
+	job->exitCode = runScript(batch->options, batch->paths[index], worker->output, worker->errors);
+	fflush(worker->output);
+	fflush(worker->errors);
+	capture(worker->output, &job->output, &job->outputLength);
+	capture(worker->errors, &job->errors, &job->errorsLength);
+	job->nanos = nanoTime() - start;
+
+	mtx_lock(&batch->lock);
+	job->done = true;
+	cnd_broadcast(&batch->jobDone);
+	mtx_unlock(&batch->lock);
+}
+
+static int runWorker(void* arg) {
+	Worker* worker = (Worker*)arg;
+	for (int job; (job = takeJob(worker)) != -1;) runJob(worker, job);
+	return 0;
+}
+
+static void emitJob(BatchJob* job) {
+	if (job->output != NULL) fwrite(job->output, 1, job->outputLength, stdout);
+	if (job->errors != NULL) {
+		fflush(stdout); // keeps a failing script's output ahead of its error, as it would be on a terminal
+		fwrite(job->errors, 1, job->errorsLength, stderr);
+	}
+	free(job->output);
+	free(job->errors);
+	job->output = NULL;
+	job->errors = NULL;
+}
+
+static void printSummary(Batch* batch, int count, uint64_t wallNanos) {
+	uint64_t busyNanos = 0;
+	int failed = 0;
+	for (int i = 0; i < count; i++) {
+		BatchJob* job = &batch->jobs[i];
+		fprintf(stderr, "%s: exit %d (%.2f ms)\n", batch->paths[i], job->exitCode, job->nanos / 1e6);
+		busyNanos += job->nanos;
+		if (job->exitCode != 0) failed++;
+	}
+
+	// The per-script times are wall clock too, so with more threads than cores their sum overstates the work
+	double seconds = wallNanos / 1e9;
+	fprintf(stderr, "-- %d scripts, %d failed, on %d threads in %.2f ms (%.1f scripts/s, %.2f ms per script)\n",
+		count, failed, batch->workerCount, wallNanos / 1e6,
+		seconds > 0 ? count / seconds : 0.0, busyNanos / 1e6 / count);
+}
+
+int runBatch(const char** paths, int count, BatchOptions* options) {
+	if (count == 0) return 0;
+
+	int workerCount = options->threadCount;
+	if (workerCount > count) workerCount = count;
+	if (workerCount > BATCH_THREADS_MAX) workerCount = BATCH_THREADS_MAX;
+	if (workerCount < 1) workerCount = 1;
+
+	Batch batch;
+	batch.paths = paths;
+	batch.options = options;
+	batch.jobs = (BatchJob*)calloc((size_t)count, sizeof(BatchJob));
+	batch.workers = (Worker*)calloc((size_t)workerCount, sizeof(Worker));
+	batch.workerCount = workerCount;
+	if (batch.jobs == NULL || batch.workers == NULL) {
+		fprintf(stderr, "Not enough memory to start the batch.\n");
+		exit(74);
+	}
+	mtx_init(&batch.lock, mtx_plain);
+	cnd_init(&batch.jobDone);
+
+	// Every worker starts with an even, contiguous share - stealing evens out scripts of different lengths
+	for (int i = 0; i < workerCount; i++) {
+		Worker* worker = &batch.workers[i];
+		worker->batch = &batch;
+		worker->index = i;
+		worker->queue.next = (int)((long long)count * i / workerCount);
+		worker->queue.end = (int)((long long)count * (i + 1) / workerCount);
+		mtx_init(&worker->queue.lock, mtx_plain);
+		worker->output = tmpfile();
+		worker->errors = tmpfile();
+	}
+
+	// A worker without scratch files or a thread just never runs - its share gets stolen by the others.
+	// If no thread starts at all this thread does all the work before emitting anything
+	uint64_t start = nanoTime();
+	thrd_t threads[BATCH_THREADS_MAX];
+	bool started[BATCH_THREADS_MAX] = { false };
+	int startedCount = 0;
+	for (int i = 0; i < workerCount; i++) {
+		Worker* worker = &batch.workers[i];
+		if (worker->output == NULL || worker->errors == NULL) continue;
+		started[i] = thrd_create(&threads[i], runWorker, worker) == thrd_success;
+		if (started[i]) startedCount++;
+	}
+	if (startedCount == 0) {
+		for (int i = 0; i < workerCount && startedCount == 0; i++) {
+			if (batch.workers[i].output == NULL || batch.workers[i].errors == NULL) continue;
+			runWorker(&batch.workers[i]);
+			startedCount++;
+		}
+		if (startedCount == 0) {
+			fprintf(stderr, "Could not create files to capture script output.\n");
+			exit(74);
+		}
+	}
+
+	// Emitting in order as the jobs finish keeps memory down to the jobs that finished early
+	int worstExitCode = 0;
+	for (int i = 0; i < count; i++) {
+		mtx_lock(&batch.lock);
+		while (!batch.jobs[i].done) cnd_wait(&batch.jobDone, &batch.lock);
+		mtx_unlock(&batch.lock);
+
+		emitJob(&batch.jobs[i]);
+		if (batch.jobs[i].exitCode > worstExitCode) worstExitCode = batch.jobs[i].exitCode;
+	}
+	fflush(stdout);
+	uint64_t wallNanos = nanoTime() - start;
+
+	for (int i = 0; i < workerCount; i++) {
+		Worker* worker = &batch.workers[i];
+		if (started[i]) thrd_join(threads[i], NULL);
+		if (worker->output != NULL) fclose(worker->output);
+		if (worker->errors != NULL) fclose(worker->errors);
+		mtx_destroy(&worker->queue.lock);
+	}
+
+	printSummary(&batch, count, wallNanos);
+
+	cnd_destroy(&batch.jobDone);
+	mtx_destroy(&batch.lock);
+	free(batch.workers);
+	free(batch.jobs);
+	return worstExitCode;
+}
+
+bool readManifest(const char* path, char** contents, const char*** paths, int* count) {
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) return false;
+
+	fseek(file, 0L, SEEK_END);
+	long size = ftell(file);
+	rewind(file);
+	char* buffer = size < 0 ? NULL : (char*)malloc((size_t)size + 1);
+	if (buffer == NULL) {
+		fclose(file);
+		return false;
+	}
+	size_t length = fread(buffer, 1, (size_t)size, file);
+	buffer[length] = '\0';
+	fclose(file);
+
+	// Lines are cut in place, so the paths are just pointers into the buffer
+	int capacity = 0;
+	*count = 0;
+	*paths = NULL;
+	for (char* line = buffer; *line != '\0';) {
+		char* end = line + strcspn(line, "\n");
+		char* next = *end == '\0' ? end : end + 1;
+		while (end > line && (end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t')) end--;
+		*end = '\0';
+
+		if (line[0] != '\0' && line[0] != '#') {
+			if (*count == capacity) {
+				capacity = capacity < 8 ? 8 : capacity * 2;
+				const char** grown = (const char**)realloc((void*)*paths, sizeof(const char*) * capacity);
+				if (grown == NULL) {
+					free((void*)*paths);
+					free(buffer);
+					return false;
+				}
+				*paths = grown;
+			}
+			(*paths)[(*count)++] = line;
+		}
+		line = next;
+	}
+
+	*contents = buffer;
+	return true;
+}
@@ -0,0 +1,24 @@
+#ifndef clox_batch_h
+#define clox_batch_h
+
+#include "../common.h"
+
+typedef struct {
+	int threadCount;			// worker threads, each running one script at a time in its own VM
+	const char* cacheDirectory;	// passed on to every VM, NULL to always compile
+	int lexThreads;
+	bool printCode;
+	bool stressGC;
+	int markThreads;
+} BatchOptions;
+
+// Runs every script in paths on a pool of worker threads. Each script's stdout and stderr are captured
+// and replayed in the order the paths were given, followed by a summary on stderr. Returns the worst
+// exit code any script would have had on its own - 0 when every one succeeded
+int runBatch(const char** paths, int count, BatchOptions* options);
+
+// Reads a manifest of script paths, one per line. Blank lines and lines starting with '#' are skipped.
+// The paths point into *contents, which the caller frees after the batch has run
+bool readManifest(const char* path, char** contents, const char*** paths, int* count);
+
+#endif
@@ -1,77 +1,294 @@
 #include <stdlib.h>
+#include <string.h>
 #include "../chunk/chunk.h"
 #include "../memory/memory.h"
+#include "../objects/objects.h"
+
+#define CONSTANT_INDEX_MAX_LOAD 0.75
+
+static void initConstantIndex(ConstantIndex* index) {
+	index->slots = NULL;
+	index->capacity = 0;
+	index->lookups = 0;
+	index->hits = 0;
+}
 
 void initChunk(Chunk* chunk) {
 	chunk->count = 0;
 	chunk->capacity = 0;
 	chunk->code = NULL; 
 	initValueArray(&chunk->constants);
+	initConstantIndex(&chunk->constantIndex);
 
 	chunk->lines = NULL;
 	chunk->linesCapacity = 0;
 	chunk->linesCount = 0;
+
+	chunk->maxStackDepth = 0;
+	chunk->inputCount = 0;
 } 
 
-void writeChunk(Chunk* chunk, uint8_t byte, int line) {
+void writeChunk(VM* vm, Chunk* chunk, uint8_t byte, int line) {
 	
 	// Updating Bytecode Array Data
 	if (chunk->capacity < chunk->count + 1) {
 		int oldCapacity = chunk->capacity;
 		chunk->capacity = GROW_CAPACITY(oldCapacity);
-		chunk->code = GROW_ARRAY(uint8_t, chunk->code, oldCapacity, chunk->capacity);
+		chunk->code = GROW_ARRAY(vm, uint8_t, chunk->code, oldCapacity, chunk->capacity);
 	}
 
-	// Updating Line Data
-	if (line > chunk->linesCount) {
-		
-		if (chunk->linesCapacity <  chunk->linesCount + 1) {
+	// Updating Line Data - a new run only starts when the line changes
+	if (chunk->linesCount == 0 || chunk->lines[chunk->linesCount - 1].line != line) {
+		if (chunk->linesCapacity < chunk->linesCount + 1) {
 			int oldCapacity = chunk->linesCapacity;
 			chunk->linesCapacity = GROW_CAPACITY(oldCapacity);
-			chunk->lines = GROW_ARRAY(int*, chunk->lines, oldCapacity, chunk->linesCapacity);
-		} 
-
-		// New Line into 2D Line Array
-		chunk->lines[chunk->linesCount] = NULL;
-		chunk->lines[chunk->linesCount] = GROW_ARRAY(int, chunk->lines[chunk->linesCount], 0, 2);
-		chunk->lines[chunk->linesCount][0] = 1;
-		chunk->lines[chunk->linesCount][1] = line; 
-		chunk->linesCount++;
+			chunk->lines = GROW_ARRAY(vm, LineStart, chunk->lines, oldCapacity, chunk->linesCapacity);
+		}
+
+		LineStart* lineStart = &chunk->lines[chunk->linesCount++];
+		lineStart->offset = chunk->count;
+		lineStart->line = line;
 	}
-	else { chunk->lines[chunk->linesCount-1][0]++; }
 
 	chunk->code[chunk->count] = byte;
 	chunk->count++;
 } 
 
-void freeChunk(Chunk* chunk) {
-	FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-	freeValueArray(&chunk->constants);
+void freeChunk(VM* vm, Chunk* chunk) {
+	FREE_ARRAY(vm, uint8_t, chunk->code, chunk->capacity);
+	freeValueArray(vm, &chunk->constants);
+	FREE_ARRAY(vm, int, chunk->constantIndex.slots, chunk->constantIndex.capacity);
 
-	// Free 2D Line Array - Print the values for testing first (?)
-	for (int i = 0; i < chunk->linesCount; i++) { FREE_ARRAY(int, chunk->lines[i], 2); }
-	FREE_ARRAY(int*, chunk->lines, chunk->linesCapacity);
+	FREE_ARRAY(vm, LineStart, chunk->lines, chunk->linesCapacity);
 
 	initChunk(chunk);
 }
 
-int addConstant(Chunk* chunk, Value value) {
-	// chunk->constants = ValueArray
-	// ValueArray->values, count
-	
-	writeValueArray(&chunk->constants, value);
+static uint32_t hashConstant(Value value) {
+	// Numbers hash their bit pattern, strings reuse their cached hash - nil and bools never reach the pool
+	if (IS_NUMBER(value)) {
+		double number = AS_NUMBER(value);
+		uint64_t bits;
+		memcpy(&bits, &number, sizeof(double));
+		bits ^= bits >> 33;
+		bits *= 0xff51afd7ed558ccdull;
+		bits ^= bits >> 33;
+		return (uint32_t)bits;
+	}
+	if (IS_STRING(value)) return AS_STRING(value)->hash;
+	if (IS_ROPE(value)) return (uint32_t)((uintptr_t)AS_OBJ(value) >> 4); // only while compiling, see replaceConstant()
+	return IS_NIL(value) ? 1 : 2 + AS_BOOL(value);
+}
+
+static bool sameConstant(Value a, Value b) {
+	// Numbers must match bit for bit - 0 and -0 compare equal but print (and divide) differently,
+	// while a NaN should still be able to share a slot with itself
+	if (IS_NUMBER(a) || IS_NUMBER(b)) {
+		if (!IS_NUMBER(a) || !IS_NUMBER(b)) return false;
+		double x = AS_NUMBER(a);
+		double y = AS_NUMBER(b);
+		return memcmp(&x, &y, sizeof(double)) == 0;
+	}
+	if (IS_OBJ(a) || IS_OBJ(b)) return IS_OBJ(a) && IS_OBJ(b) && AS_OBJ(a) == AS_OBJ(b); // strings are interned
+	if (IS_NIL(a) || IS_NIL(b)) return IS_NIL(a) && IS_NIL(b);
+	return AS_BOOL(a) == AS_BOOL(b);
+}
+
+static int* findSlot(Chunk* chunk, Value value) {
+	// Linear probing - returns the bucket holding the value or the empty bucket it would go in
+	ConstantIndex* index = &chunk->constantIndex;
+	uint32_t bucket = hashConstant(value) & (index->capacity - 1);
+
+	for (;;) {
+		int* slot = &index->slots[bucket];
+		if (*slot == -1 || sameConstant(chunk->constants.values[*slot], value)) return slot;
+		bucket = (bucket + 1) & (index->capacity - 1);
+	}
+}
+
+static void growConstantIndex(VM* vm, Chunk* chunk) {
+	ConstantIndex* index = &chunk->constantIndex;
+	FREE_ARRAY(vm, int, index->slots, index->capacity);
+
+	index->capacity = GROW_CAPACITY(index->capacity);
+	index->slots = ALLOCATE(vm, int, index->capacity);
+	for (int i = 0; i < index->capacity; i++) index->slots[i] = -1;
+
+	for (int i = 0; i < chunk->constants.count; i++) {
+		*findSlot(chunk, chunk->constants.values[i]) = i;
+	}
+}
+
+static void removeFromConstantIndex(Chunk* chunk, int constant) {
+	// Backward shift deletion - later entries of the same probe run move up so lookups never hit a gap
+	ConstantIndex* index = &chunk->constantIndex;
+	int mask = index->capacity - 1;
+	int hole = (int)(findSlot(chunk, chunk->constants.values[constant]) - index->slots);
+	index->slots[hole] = -1;
+
+	for (int bucket = (hole + 1) & mask; index->slots[bucket] != -1; bucket = (bucket + 1) & mask) {
+		int home = (int)(hashConstant(chunk->constants.values[index->slots[bucket]]) & mask);
+
+		// Only move the entry if its home bucket is not between the hole and where it currently sits
+		bool between = hole <= bucket ? (hole < home && home <= bucket) : (hole < home || home <= bucket);
+		if (!between) {
+			index->slots[hole] = index->slots[bucket];
+			index->slots[bucket] = -1;
+			hole = bucket;
+		}
+	}
+}
+
+int addConstant(VM* vm, Chunk* chunk, Value value) {
+	// Identical numbers and strings reuse an existing slot, keeping the pool small enough
+	// for the 1 byte OP_CONSTANT operand for as long as possible
+	ConstantIndex* index = &chunk->constantIndex;
+	index->lookups++;
+
+	if (chunk->constants.count + 1 > index->capacity * CONSTANT_INDEX_MAX_LOAD) {
+		growConstantIndex(vm, chunk);
+	}
+
+	int* slot = findSlot(chunk, value);
+	if (*slot != -1) {
+		index->hits++;
+		return *slot;
+	}
+
+	writeValueArray(vm, &chunk->constants, value);
 	// -1 is required because count holds the # of values and is not 0-indexed
 	// which is what we need for indexing the ValueArray (used in our bytecode instruction's operand)
-	return chunk->constants.count - 1; 
-	
+	*slot = chunk->constants.count - 1;
+	return *slot;
+}
+
+void truncateChunk(Chunk* chunk, int count, int constantCount) {
+	// Drops every byte from 'count' onwards (and their line info) plus the constants added after 'constantCount'
+	while (chunk->linesCount > 0 && chunk->lines[chunk->linesCount - 1].offset >= count) {
+		chunk->linesCount--;
+	}
+
+	while (chunk->constants.count > constantCount) {
+		removeFromConstantIndex(chunk, chunk->constants.count - 1);
+		chunk->constants.count--;
+	}
+	chunk->count = count;
+}
+
+void replaceConstant(Chunk* chunk, int constant, Value value) {
+	// Swaps a constant in place - the code keeps using its index. The compiler uses this to turn the ropes
+	// it folds string chains into into their flattened strings
+	removeFromConstantIndex(chunk, constant);
+	chunk->constants.values[constant] = value;
+	int* slot = findSlot(chunk, value);
+	if (*slot == -1) *slot = constant; // an equal constant further up keeps serving new lookups
+}
+
+void takeConstants(VM* vm, Chunk* chunk, Chunk* from) {
+	// Moves the constant pool (and its index) over, leaving 'from' with an empty one
+	freeValueArray(vm, &chunk->constants);
+	FREE_ARRAY(vm, int, chunk->constantIndex.slots, chunk->constantIndex.capacity);
+
+	chunk->constants = from->constants;
+	chunk->constantIndex = from->constantIndex;
+	initValueArray(&from->constants);
+	initConstantIndex(&from->constantIndex);
 }
 
 int getLine(Chunk* chunk, int byteIndex) {
 	
-	for (int i = 0; i < chunk->linesCount; i++) {
-		if (byteIndex < chunk->lines[i][0]) {
-			return chunk->lines[i][1];
+	// Binary search for the last run starting at or before byteIndex
+	int low = 0;
+	int high = chunk->linesCount - 1;
+	int found = -1;
+
+	while (low <= high) {
+		int mid = low + (high - low) / 2;
+		if (chunk->lines[mid].offset <= byteIndex) {
+			found = mid;
+			low = mid + 1;
+		}
+		else {
+			high = mid - 1;
 		}
 	}
-	return 0;
+
+	return found == -1 ? 0 : chunk->lines[found].line;
 } 
+
+int instructionLength(uint8_t instruction) {
+	// Opcode byte plus its operands
+	switch (instruction) {
+		case OP_CONSTANT:
+		case OP_GET_INPUT:
+		case OP_ADD_CONSTANT:
+		case OP_SUBTRACT_CONSTANT:
+		case OP_MULTIPLY_CONSTANT:
+		case OP_DIVIDE_CONSTANT:
+			return 2;
+		case OP_CONSTANT_LONG: return 4;
+		default: return 1;
+	}
+}
+
+int stackEffect(uint8_t instruction) {
+	// Net number of values an instruction leaves on the stack (pushes - pops)
+	switch (instruction) {
+		case OP_CONSTANT:
+		case OP_CONSTANT_LONG:
+		case OP_GET_INPUT:
+		case OP_NIL:
+		case OP_TRUE:
+		case OP_FALSE:
+			return 1;
+		case OP_EQUAL:
+		case OP_GREATER:
+		case OP_LESS:
+		case OP_ADD:
+		case OP_SUBTRACT:
+		case OP_MULTIPLY:
+		case OP_DIVIDE:
+		case OP_NOT_EQUAL:
+		case OP_GREATER_EQUAL:
+		case OP_LESS_EQUAL:
+			return -1;
+		case OP_NOT:
+		case OP_NEGATE:
+		case OP_ADD_CONSTANT:
+		case OP_SUBTRACT_CONSTANT:
+		case OP_MULTIPLY_CONSTANT:
+		case OP_DIVIDE_CONSTANT:
+			return 0;
+		case OP_RETURN:
+			return -1;
+		default:
+			return 0;
+	}
+}
+
+int stackInputs(uint8_t instruction) {
+	// Number of values an instruction pops (or reads in place) - the stack must hold at least this many
+	switch (instruction) {
+		case OP_EQUAL:
+		case OP_GREATER:
+		case OP_LESS:
+		case OP_ADD:
+		case OP_SUBTRACT:
+		case OP_MULTIPLY:
+		case OP_DIVIDE:
+		case OP_NOT_EQUAL:
+		case OP_GREATER_EQUAL:
+		case OP_LESS_EQUAL:
+			return 2;
+		case OP_NOT:
+		case OP_NEGATE:
+		case OP_ADD_CONSTANT:
+		case OP_SUBTRACT_CONSTANT:
+		case OP_MULTIPLY_CONSTANT:
+		case OP_DIVIDE_CONSTANT:
+		case OP_RETURN:
+			return 1;
+		default:
+			return 0;
+	}
+}
@@ -20,24 +20,59 @@ typedef enum {
 	OP_NOT,
 	OP_NEGATE,
 	OP_RETURN, 
+	OP_GET_INPUT,	// pushes one of the values the embedder passed to runProgram()
+	// Superinstructions - only ever produced by the peephole pass in optimizer.c
+	OP_NOT_EQUAL,
+	OP_GREATER_EQUAL,
+	OP_LESS_EQUAL,
+	OP_ADD_CONSTANT,
+	OP_SUBTRACT_CONSTANT,
+	OP_MULTIPLY_CONSTANT,
+	OP_DIVIDE_CONSTANT,
 } OpCode;
 
+#define OPCODE_COUNT (OP_DIVIDE_CONSTANT + 1) // keep in sync with the last opcode above
+
+typedef struct {
+	// Hashed side-index into a chunk's constant pool so repeated literals share one slot
+	int* slots;		// open addressing buckets holding a constant's position, -1 when empty
+	int capacity;
+	int lookups;	// addConstant() calls
+	int hits;		// ...answered with an existing slot
+} ConstantIndex;
+
+typedef struct {
+	// One entry per run of bytes from the same source line - stored in offset order so getLine() can binary search
+	int offset; // first byte of the run
+	int line;
+} LineStart;
+
 typedef struct { 
 	int count;
 	int capacity;
 	ValueArray constants; 
+	ConstantIndex constantIndex;
 	uint8_t* code; 
 	
-	int** lines;
+	LineStart* lines;
 	int linesCapacity;
 	int linesCount;
+
+	int maxStackDepth; // deepest the VM stack gets while running this chunk - computed by the compiler
+	int inputCount; // OP_GET_INPUT operands are below this
 } Chunk; 
 
 void initChunk(Chunk* chunk);
-void writeChunk(Chunk* chunk, uint8_t byte, int line);
-void freeChunk(Chunk* chunk);
-int addConstant(Chunk* chunk, Value value);
+void writeChunk(VM* vm, Chunk* chunk, uint8_t byte, int line);
+void freeChunk(VM* vm, Chunk* chunk);
+int addConstant(VM* vm, Chunk* chunk, Value value);
+void truncateChunk(Chunk* chunk, int count, int constantCount);
+void replaceConstant(Chunk* chunk, int constant, Value value);
+void takeConstants(VM* vm, Chunk* chunk, Chunk* from);
 int getLine(Chunk* chunk, int byteIndex);
+int instructionLength(uint8_t instruction);
+int stackEffect(uint8_t instruction);
+int stackInputs(uint8_t instruction);
 
 #endif
 
@@ -5,8 +5,17 @@
 #include <stddef.h>
 #include <stdint.h> 
 
-#define DEBUG_PRINT_CODE
-#define DEBUG_TRACE_EXECUTION
+// Every function that allocates or touches interpreter state takes the VM it works on
+typedef struct VM VM;
+
+// Define NAN_BOXING to pack every Value into a single 8 byte double instead of a 16 byte tagged struct
+// #define NAN_BOXING
+
+// Threaded dispatch needs the "labels as values" extension, so it is only on for GCC and Clang.
+// Define NO_COMPUTED_GOTO to fall back to the portable switch in run()
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(NO_COMPUTED_GOTO)
+#define COMPUTED_GOTO
+#endif
 
 #endif
 
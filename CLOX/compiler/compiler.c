@@ -1,22 +1,25 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "../common.h"
 #include "compiler.h"
+#include "optimizer.h"
 #include "../scanner/scanner.h"
 #include "../objects/objects.h"
 
 #define THREE_BYTE_MAX 16777216
-
-#ifdef DEBUG_PRINT_CODE
-#include "../disassemmbler/disassemble.h"
-#endif
+#define INPUTS_MAX 256 // OP_GET_INPUT has a 1 byte operand
 
 typedef struct {
 	Token current;
 	Token previous;
 	bool hadError;
 	bool panicMode;
+
+	Scanner scanner;	// tokens are pulled from here one at a time...
+	TokenArray* tokens;	// ...unless the whole source was scanned up front, then they come from here
+	int nextToken;
 } Parser;
 
 typedef enum {
@@ -33,8 +36,10 @@ typedef enum {
 	PREC_PRIMARY
 } Precedence;
 
+typedef struct Compiler Compiler;
+
 // A Function Pointer - holds address of function
-typedef void (*ParseFn)();
+typedef void (*ParseFn)(Compiler* compiler);
 
 typedef struct { 
 	// Represents a single row in the parsing table
@@ -43,180 +48,309 @@ typedef struct {
 	Precedence precedence;
 } ParseRule;
 
-Parser parser; 
-Chunk* compilingChunk; 
+typedef struct {
+	// The most recently emitted literal load - what constant folding checks its operands against
+	int start;			// offset of the load instruction, -1 if nothing has been emitted yet
+	int end;			// offset just past it
+	int constantMark;	// size of the constant pool before the literal was added
+	Value value;
+} Literal;
+
+struct Compiler {
+	// Everything one compile() call works on - lives on its stack, so compiles on different threads never meet
+	VM* vm;			// owns the strings and constants the chunk ends up with
+	Parser parser;
+	Chunk* chunk;
+	Literal lastLiteral;
+	const char* const* inputNames; // identifiers the source may use, see compileProgram()
+	int inputCount;
+};
 
-static Chunk* currentChunk() {
-	return compilingChunk;
+static Chunk* currentChunk(Compiler* compiler) {
+	return compiler->chunk;
 }
 
-static void errorAt(Token* token, const char* message) {
-	if (parser.panicMode) return; // don't want to spew the rest of the errors and have an error cascade
-	parser.panicMode = true;
-	fprintf(stderr, "[line %d] Error", token->line);
+static void errorAt(Compiler* compiler, Token* token, const char* message) {
+	if (compiler->parser.panicMode) return; // don't want to spew the rest of the errors and have an error cascade
+	compiler->parser.panicMode = true;
+	fprintf(compiler->vm->errorOutput, "[line %d] Error", token->line);
 
 	if (token->type == TOKEN_EOF) { // if the prev token was TOKEN_ERROR and the current one is TOKEN_EOF
-		fprintf(stderr, " at end");
+		fprintf(compiler->vm->errorOutput, " at end");
 	}
 	else if (token->type == TOKEN_ERROR) {
 		// Nothing
 	}
 	else {
-		fprintf(stderr, " at '%.*s'", token->length, token->start); // consumed token was not of expected type
+		fprintf(compiler->vm->errorOutput, " at '%.*s'", token->length, token->start); // consumed token was not of expected type
 	} 
 
-	fprintf(stderr, ": %s\n", message);
-	parser.hadError = true;
+	fprintf(compiler->vm->errorOutput, ": %s\n", message);
+	compiler->parser.hadError = true;
 }
 
-static void error(const char* message) {
-	errorAt(&parser.previous, message);
+static void error(Compiler* compiler, const char* message) {
+	errorAt(compiler, &compiler->parser.previous, message);
 }
 
-static void errorAtCurrent(const char* message) {
-	errorAt(&parser.current, message);
+static void errorAtCurrent(Compiler* compiler, const char* message) {
+	errorAt(compiler, &compiler->parser.current, message);
 }
 
-static void advance() {
+static Token nextToken(Compiler* compiler) {
+	if (compiler->parser.tokens == NULL) return scanToken(&compiler->parser.scanner);
+
+	// The last token is TOKEN_EOF, which keeps being returned just like the scanner does at the end
+	Token token = compiler->parser.tokens->tokens[compiler->parser.nextToken];
+	if (compiler->parser.nextToken < compiler->parser.tokens->count - 1) compiler->parser.nextToken++;
+	return token;
+}
+
+static void advance(Compiler* compiler) {
 	// CLOX's scanner leaves an error token (if error in source) and leaves it up to the parser to handle it
 	// The parser asks the scanner repeatedly for the next token in the loop
 
-	parser.previous = parser.current; 
+	compiler->parser.previous = compiler->parser.current; 
 
 	for (;;) {
-		parser.current = scanToken();
-		if (parser.current.type != TOKEN_ERROR) break; 
-		errorAtCurrent(parser.current.start);
+		compiler->parser.current = nextToken(compiler);
+		if (compiler->parser.current.type != TOKEN_ERROR) break; 
+		errorAtCurrent(compiler, compiler->parser.current.start);
 	}
 }
 
-static void consume(TokenType type, const char* message) {
-	if (parser.current.type == type) {
-		advance();
+static void consume(Compiler* compiler, TokenType type, const char* message) {
+	if (compiler->parser.current.type == type) {
+		advance(compiler);
 		return;
 	} 
 
-	errorAtCurrent(message);
+	errorAtCurrent(compiler, message);
 } 
 
-static void emitByte(uint8_t byte) {
-	writeChunk(currentChunk(), byte, parser.previous.line);
+static void emitByte(Compiler* compiler, uint8_t byte) {
+	writeChunk(compiler->vm, currentChunk(compiler), byte, compiler->parser.previous.line);
 } 
 
-static void emitBytes(uint8_t byte1, uint8_t byte2) {
+static void emitBytes(Compiler* compiler, uint8_t byte1, uint8_t byte2) {
 	// Defined for convenience when we need to write an opcode and its operand together
-	emitByte(byte1);
-	emitByte(byte2);
+	emitByte(compiler, byte1);
+	emitByte(compiler, byte2);
+}
+
+static void emitReturn(Compiler* compiler) {
+	emitByte(compiler, OP_RETURN);
+}
+
+static void emitConstant(Compiler* compiler, Value value) {
+	// Adds the value to the chunk's constant pool (or finds it already there) and emits the load.
+	// Indices that don't fit in a byte use OP_CONSTANT_LONG with a 3 byte little-endian operand
+	int constantIndex = addConstant(compiler->vm, currentChunk(compiler), value);
+
+	if (constantIndex <= UINT8_MAX) {
+		emitBytes(compiler, OP_CONSTANT, (uint8_t)constantIndex);
+		return;
+	}
+
+	if (constantIndex >= THREE_BYTE_MAX) {
+		error(compiler, "Too many constants in one chunk. Maximum allowed are 2^24.");
+		return;
+	}
+
+	emitBytes(compiler, OP_CONSTANT_LONG, (uint8_t)(constantIndex & 0xff)); // LSB
+	emitBytes(compiler, (uint8_t)((constantIndex >> 8) & 0xff), (uint8_t)((constantIndex >> 16) & 0xff)); // MSB last
+}
+
+static void emitLiteral(Compiler* compiler, Value value) {
+	// Every compile-time known value goes through here so folding can find and replace it later
+	compiler->lastLiteral.start = currentChunk(compiler)->count;
+	compiler->lastLiteral.constantMark = currentChunk(compiler)->constants.count;
+	compiler->lastLiteral.value = value;
+
+	if (IS_NIL(value)) emitByte(compiler, OP_NIL);
+	else if (IS_BOOL(value)) emitByte(compiler, AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+	else emitConstant(compiler, value);
+
+	compiler->lastLiteral.end = currentChunk(compiler)->count;
+}
+
+static bool endsWithLiteral(Compiler* compiler, int start) {
+	// True when everything emitted from 'start' onwards is one literal load
+	return compiler->lastLiteral.start == start && compiler->lastLiteral.end == currentChunk(compiler)->count;
 }
 
-static void emitReturn() {
-	emitByte(OP_RETURN);
+static void replaceWithLiteral(Compiler* compiler, Literal* first, Value value) {
+	// Throw away the operand loads (and the constants only they used) and load the folded value instead
+	truncateChunk(currentChunk(compiler), first->start, first->constantMark);
+	emitLiteral(compiler, value);
 }
 
-static uint8_t makeConstant(Value value) {
-	int constantIndex = addConstant(currentChunk(), value);
-	return (uint8_t)constantIndex; // index returned takes up 1 byte in space - "bytecode"
+static bool isFalsey(Value value) {
+	// Must agree with the VM's isFalsey() - NIL and false are falsey and every other value is true
+	return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
-static void writeConstant(Chunk* chunk, Value value, int line) {
-	uint32_t constantIndex = (uint32_t)addConstant(chunk, value);
-	if (constantIndex > THREE_BYTE_MAX) {
-		error("Too many constants in one chunk. Maximum allowed are 2^24.");
-		return 0;
+static bool foldBinary(Compiler* compiler, TokenType operatorType, Value a, Value b, Value* result) {
+	// Only folds when the VM would succeed - anything that is a runtime error is left for the VM to report
+	if (operatorType == TOKEN_EQUAL_EQUAL || operatorType == TOKEN_BANG_EQUAL) {
+		bool equal = valuesEqual(compiler->vm, a, b);
+		*result = BOOL_VAL(operatorType == TOKEN_EQUAL_EQUAL ? equal : !equal);
+		return true;
 	}
 
-	uint8_t byteArr[3];
-	uint8_t* x = (uint8_t*)&constantIndex;
-	byteArr[0] = x[0]; // LSB
-	byteArr[1] = x[1];
-	byteArr[2] = x[2]; // MSB
+	if (operatorType == TOKEN_PLUS && IS_STRING_OR_ROPE(a) && IS_STRING_OR_ROPE(b)) {
+		// A rope once it is long enough, like at runtime - copying every step of "a" + "b" + ... would be
+		// quadratic. Whatever rope ends up in the pool is flattened once by flattenConstants()
+		*result = OBJ_VAL(concatenate(compiler->vm, AS_OBJ(a), AS_OBJ(b)));
+		return true;
+	}
+
+	if (!IS_NUMBER(a) || !IS_NUMBER(b)) return false;
 
-	emitBytes(OP_CONSTANT_LONG, byteArr[0]);
-	emitBytes(byteArr[1], byteArr[2]);
+	double x = AS_NUMBER(a);
+	double y = AS_NUMBER(b);
+	switch (operatorType) {
+		case TOKEN_GREATER:       *result = BOOL_VAL(x > y); return true;
+		case TOKEN_GREATER_EQUAL: *result = BOOL_VAL(!(x < y)); return true; // same NaN behaviour as OP_LESS OP_NOT
+		case TOKEN_LESS:          *result = BOOL_VAL(x < y); return true;
+		case TOKEN_LESS_EQUAL:    *result = BOOL_VAL(!(x > y)); return true;
+		case TOKEN_PLUS:		  *result = NUMBER_VAL(x + y); return true;
+		case TOKEN_MINUS:		  *result = NUMBER_VAL(x - y); return true;
+		case TOKEN_STAR:		  *result = NUMBER_VAL(x * y); return true;
+		case TOKEN_SLASH:		  *result = NUMBER_VAL(x / y); return true;
+		default: return false;
+	}
 }
 
-static void emitConstant(Value value) {
-	// Adds Instruction + Index (Byte sized) to the code array in the chunk
-	// Floating point value is added to the chunk's constants attribute
-	
-	if (currentChunk()->constants.count > UINT8_MAX) {
-		writeConstant(currentChunk(), value, parser.previous.line);
+static void computeStackDepth(Chunk* chunk) {
+	// The bytecode has no jumps yet, so one linear walk sees every instruction in execution order
+	int depth = 0;
+	int maxDepth = 0;
+
+	for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk->code[offset])) {
+		depth += stackEffect(chunk->code[offset]);
+		if (depth > maxDepth) maxDepth = depth;
 	}
-	else { emitBytes(OP_CONSTANT, makeConstant(value)); }
+
+	chunk->maxStackDepth = maxDepth;
 }
 
-static void endCompiler() {
-	emitReturn(); 
+static void flattenConstants(Compiler* compiler) {
+	// Constants have to be interned strings, never ropes
+	Chunk* chunk = currentChunk(compiler);
+	for (int i = 0; i < chunk->constants.count; i++) {
+		Value constant = chunk->constants.values[i];
+		if (IS_ROPE(constant)) replaceConstant(chunk, i, OBJ_VAL(flattenString(compiler->vm, AS_OBJ(constant))));
+	}
+}
 
-	#ifdef DEBUG_PRINT_CODE 
-	if (!parser.hadError) {
-		disassembleChunk(currentChunk(), "code");
-	} 
-	#endif
+static void endCompiler(Compiler* compiler) {
+	emitReturn(compiler); 
+	flattenConstants(compiler);
+	optimizeChunk(compiler->vm, currentChunk(compiler));
+	computeStackDepth(currentChunk(compiler));
 }
 
-static void expression();
+static void expression(Compiler* compiler);
 static ParseRule* getRule(TokenType type);
-static void parsePrecedence(Precedence precedence);
+static void parsePrecedence(Compiler* compiler, Precedence precedence);
 
-static void binary() {
+static void binary(Compiler* compiler) {
 	// Infix operator has already been consumed - which is why we use the previous token
-	TokenType operatorType = parser.previous.type;
+	TokenType operatorType = compiler->parser.previous.type;
 	ParseRule* rule = getRule(operatorType);
-	parsePrecedence((Precedence)(rule->precedence + 1));
+
+	// Both operands are literals when the left one is the last thing emitted and the right one
+	// compiles to a single literal load straight after it
+	bool leftIsLiteral = compiler->lastLiteral.end == currentChunk(compiler)->count;
+	Literal left = compiler->lastLiteral;
+	parsePrecedence(compiler, (Precedence)(rule->precedence + 1));
+
+	Value folded;
+	if (!compiler->vm->debug.noFolding && leftIsLiteral && endsWithLiteral(compiler, left.end) &&
+		foldBinary(compiler, operatorType, left.value, compiler->lastLiteral.value, &folded)) {
+		replaceWithLiteral(compiler, &left, folded);
+		return;
+	}
 
 	switch (operatorType) {
-		case TOKEN_BANG_EQUAL:    emitBytes(OP_EQUAL, OP_NOT); break;
-		case TOKEN_EQUAL_EQUAL:   emitByte(OP_EQUAL); break;
-		case TOKEN_GREATER:       emitByte(OP_GREATER); break;
-		case TOKEN_GREATER_EQUAL: emitBytes(OP_LESS, OP_NOT); break;
-		case TOKEN_LESS:          emitByte(OP_LESS); break;
-		case TOKEN_LESS_EQUAL:    emitBytes(OP_GREATER, OP_NOT); break;
-		case TOKEN_PLUS:		  emitByte(OP_ADD); break;
-		case TOKEN_MINUS:		  emitByte(OP_SUBTRACT); break;
-		case TOKEN_STAR:		  emitByte(OP_MULTIPLY); break;
-		case TOKEN_SLASH:		  emitByte(OP_DIVIDE); break;
+		case TOKEN_BANG_EQUAL:    emitBytes(compiler, OP_EQUAL, OP_NOT); break;
+		case TOKEN_EQUAL_EQUAL:   emitByte(compiler, OP_EQUAL); break;
+		case TOKEN_GREATER:       emitByte(compiler, OP_GREATER); break;
+		case TOKEN_GREATER_EQUAL: emitBytes(compiler, OP_LESS, OP_NOT); break;
+		case TOKEN_LESS:          emitByte(compiler, OP_LESS); break;
+		case TOKEN_LESS_EQUAL:    emitBytes(compiler, OP_GREATER, OP_NOT); break;
+		case TOKEN_PLUS:		  emitByte(compiler, OP_ADD); break;
+		case TOKEN_MINUS:		  emitByte(compiler, OP_SUBTRACT); break;
+		case TOKEN_STAR:		  emitByte(compiler, OP_MULTIPLY); break;
+		case TOKEN_SLASH:		  emitByte(compiler, OP_DIVIDE); break;
 		default: return; // Unreachable.
 	}
 }
 
-static void literal() {
-	switch (parser.previous.type) {
-		case TOKEN_FALSE: emitByte(OP_FALSE); break;	
-		case TOKEN_NIL: emitByte(OP_NIL); break;
-		case TOKEN_TRUE: emitByte(OP_TRUE); break;
+static void literal(Compiler* compiler) {
+	switch (compiler->parser.previous.type) {
+		case TOKEN_FALSE: emitLiteral(compiler, BOOL_VAL(false)); break;	
+		case TOKEN_NIL: emitLiteral(compiler, NIL_VAL); break;
+		case TOKEN_TRUE: emitLiteral(compiler, BOOL_VAL(true)); break;
 		default: return;
 	}
 }
 
-static void grouping() {
+static void grouping(Compiler* compiler) {
 	// We assume the '(' has already been consumed as that is what initially
 	// invokes this function in the first place
-	expression(); 
-	consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression");
+	expression(compiler); 
+	consume(compiler, TOKEN_RIGHT_PAREN, "Expect ')' after expression");
 }
 
-static void number() { 
+static void number(Compiler* compiler) { 
 	// string -> double conversion
-	double value = strtod(parser.previous.start, NULL);
-	emitConstant(NUMBER_VAL(value));
+	double value = strtod(compiler->parser.previous.start, NULL);
+	emitLiteral(compiler, NUMBER_VAL(value));
 }
 
-static void string() {
+static void string(Compiler* compiler) {
 	// +1 and -2 trim the string quotation marks
-	emitConstant(OBJ_VAL(copyString(parser.previous.start + 1, parser.previous.length - 2)));
+	emitLiteral(compiler, OBJ_VAL(copyString(compiler->vm, compiler->parser.previous.start + 1, compiler->parser.previous.length - 2)));
 }
 
-static void unary() {
-	TokenType operatorType = parser.previous.type;
+static void input(Compiler* compiler) {
+	// Identifiers can only name the embedder's inputs for now - resolved to their slot at compile time
+	Token* name = &compiler->parser.previous;
+	for (int i = 0; i < compiler->inputCount; i++) {
+		const char* inputName = compiler->inputNames[i];
+		if (strlen(inputName) == (size_t)name->length && memcmp(inputName, name->start, name->length) == 0) {
+			emitBytes(compiler, OP_GET_INPUT, (uint8_t)i);
+			return;
+		}
+	}
+	error(compiler, "Undefined input.");
+}
+
+static void unary(Compiler* compiler) {
+	TokenType operatorType = compiler->parser.previous.type;
+	int operandStart = currentChunk(compiler)->count;
 
 	// compile the operand and other operators of higher precedence only
-	parsePrecedence(PREC_UNARY);
+	parsePrecedence(compiler, PREC_UNARY);
+
+	if (!compiler->vm->debug.noFolding && endsWithLiteral(compiler, operandStart)) {
+		Literal operand = compiler->lastLiteral;
+		if (operatorType == TOKEN_BANG) {
+			replaceWithLiteral(compiler, &operand, BOOL_VAL(isFalsey(operand.value)));
+			return;
+		}
+		if (operatorType == TOKEN_MINUS && IS_NUMBER(operand.value)) {
+			replaceWithLiteral(compiler, &operand, NUMBER_VAL(-AS_NUMBER(operand.value)));
+			return;
+		}
+	}
 
 	// Emit the operator Instruction
 	switch (operatorType) {
-		case TOKEN_BANG:emitByte(OP_NOT); break;
-		case TOKEN_MINUS: emitByte(OP_NEGATE); break;
+		case TOKEN_BANG:emitByte(compiler, OP_NOT); break;
+		case TOKEN_MINUS: emitByte(compiler, OP_NEGATE); break;
 		default: return;
 	}
 } 
@@ -239,9 +373,9 @@ ParseRule rules[] = {
   [TOKEN_EQUAL_EQUAL]	= {NULL,     binary, PREC_EQUALITY},
   [TOKEN_GREATER]		= {NULL,     binary, PREC_COMPARISON},
   [TOKEN_GREATER_EQUAL] = {NULL,     binary, PREC_COMPARISON},
-  [TOKEN_LESS]			= {NULL,     NULL,   PREC_COMPARISON},
+  [TOKEN_LESS]			= {NULL,     binary, PREC_COMPARISON},
   [TOKEN_LESS_EQUAL]	= {NULL,     binary, PREC_COMPARISON},
-  [TOKEN_IDENTIFIER]	= {NULL,     NULL,   PREC_NONE},
+  [TOKEN_IDENTIFIER]	= {input,    NULL,   PREC_NONE},
   [TOKEN_STRING]		= {string,     NULL,   PREC_NONE},
   [TOKEN_NUMBER]		= {number,   NULL,   PREC_NONE},
   [TOKEN_AND]			= {NULL,     NULL,   PREC_NONE},
@@ -264,21 +398,21 @@ ParseRule rules[] = {
   [TOKEN_EOF]			= {NULL,     NULL,   PREC_NONE},
 };
 
-static void parsePrecedence(Precedence precedence) {
-	advance();
-	ParseFn prefixRule = getRule(parser.previous.type)->prefix;
+static void parsePrecedence(Compiler* compiler, Precedence precedence) {
+	advance(compiler);
+	ParseFn prefixRule = getRule(compiler->parser.previous.type)->prefix;
 
 	if (prefixRule == NULL) {
-		error("Expect expression");
+		error(compiler, "Expect expression");
 		return;
 	}
 
-	prefixRule(); // parse in accordance to the token type
+	prefixRule(compiler); // parse in accordance to the token type
 
-	while (precedence <= getRule(parser.current.type)->precedence) {
-		advance();
-		ParseFn infixRule = getRule(parser.previous.type)->infix;
-		infixRule();
+	while (precedence <= getRule(compiler->parser.current.type)->precedence) {
+		advance(compiler);
+		ParseFn infixRule = getRule(compiler->parser.previous.type)->infix;
+		infixRule(compiler);
 	} 
 }
 
@@ -287,23 +421,52 @@ static ParseRule* getRule(TokenType type) {
 	return &rules[type];
 }
 
-static void expression() {
+static void expression(Compiler* compiler) {
 	// We simply parse the lowest precedence level
 	// which subsumes all of the higher-precedence expressions too
-	parsePrecedence(PREC_ASSIGNMENT);
+	parsePrecedence(compiler, PREC_ASSIGNMENT);
+}
+
+bool compile(VM* vm, const char* source, Chunk* chunk) { 
+	return compileWithInputs(vm, source, NULL, 0, chunk);
 }
 
-bool compile(const char* source, Chunk* chunk) { 
-	initScanner(source);
-	compilingChunk = chunk;
+bool compileWithInputs(VM* vm, const char* source, const char* const* inputNames, int inputCount, Chunk* chunk) {
+	// With vm->lexThreads set the whole source is tokenized before parsing starts, in parallel when it is large
+	if (inputCount > INPUTS_MAX) {
+		fprintf(vm->errorOutput, "Too many inputs. Maximum allowed are %d.\n", INPUTS_MAX);
+		return false;
+	}
+
+	Compiler context;
+	Compiler* compiler = &context;
+	compiler->vm = vm;
+	compiler->inputNames = inputNames;
+	compiler->inputCount = inputCount;
+	chunk->inputCount = inputCount;
+	TokenArray tokens;
+	compiler->parser.tokens = NULL;
+	if (vm->lexThreads > 0) {
+		scanTokens(source, &tokens, vm->lexThreads);
+		compiler->parser.tokens = &tokens;
+		compiler->parser.nextToken = 0;
+	}
+	else {
+		initScanner(&compiler->parser.scanner, source);
+	}
+	compiler->chunk = chunk;
+	compiler->lastLiteral.start = -1;
+	compiler->lastLiteral.end = -1;
+
+	compiler->parser.hadError = false;
+	compiler->parser.panicMode = false;
 
-	parser.hadError = false;
-	parser.panicMode = false;
+	advance(compiler); // Accounts for errors at the start - If contains an error, keeps on looping until a valid token is found
+	expression(compiler);
+	consume(compiler, TOKEN_EOF, "Expect end of expression.");
+	endCompiler(compiler); // emits the OP_RETURN bytecode instruction
 
-	advance(); // Accounts for errors at the start - If contains an error, keeps on looping until a valid token is found
-	expression();
-	consume(TOKEN_EOF, "Expect end of expression.");
-	endCompiler(); // emits the OP_RETURN bytecode instruction
-	return !parser.hadError;
+	if (compiler->parser.tokens != NULL) freeTokenArray(compiler->parser.tokens);
+	return !compiler->parser.hadError;
 }  
 
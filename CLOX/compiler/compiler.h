@@ -3,6 +3,7 @@
 
 #include "../vm/vm.h"
 
-bool compile(const char* source, Chunk* chunk);
+bool compile(VM* vm, const char* source, Chunk* chunk);
+bool compileWithInputs(VM* vm, const char* source, const char* const* inputNames, int inputCount, Chunk* chunk);
 
 #endif
@@ -0,0 +1,65 @@
+#include "../common.h"
+#include "optimizer.h"
+
+static int fusedComparison(uint8_t instruction) {
+	// OP_NOT after these is folded into a single instruction: != >= <=
+	switch (instruction) {
+		case OP_EQUAL:   return OP_NOT_EQUAL;
+		case OP_LESS:    return OP_GREATER_EQUAL;
+		case OP_GREATER: return OP_LESS_EQUAL;
+		default:		 return -1;
+	}
+}
+
+static int fusedConstantOperand(uint8_t instruction) {
+	// OP_CONSTANT right before these becomes the instruction's own operand
+	switch (instruction) {
+		case OP_ADD:      return OP_ADD_CONSTANT;
+		case OP_SUBTRACT: return OP_SUBTRACT_CONSTANT;
+		case OP_MULTIPLY: return OP_MULTIPLY_CONSTANT;
+		case OP_DIVIDE:   return OP_DIVIDE_CONSTANT;
+		default:		  return -1;
+	}
+}
+
+void optimizeChunk(VM* vm, Chunk* chunk) {
+	// Peephole pass - rewrites common instruction pairs into one superinstruction so the VM dispatches once
+	// instead of twice. There are no jumps in the bytecode yet, so no offsets need patching when it shrinks
+	Chunk optimized;
+	initChunk(&optimized);
+	optimized.inputCount = chunk->inputCount;
+
+	int offset = 0;
+	while (offset < chunk->count) {
+		uint8_t instruction = chunk->code[offset];
+		int length = instructionLength(instruction);
+		int next = offset + length;
+		uint8_t nextInstruction = next < chunk->count ? chunk->code[next] : OP_RETURN;
+
+		if (nextInstruction == OP_NOT && fusedComparison(instruction) != -1) {
+			// Keep the comparison's line - that is the instruction that can raise a runtime error
+			writeChunk(vm, &optimized, (uint8_t)fusedComparison(instruction), getLine(chunk, offset));
+			offset = next + 1;
+			continue;
+		}
+
+		if (instruction == OP_CONSTANT && next < chunk->count && fusedConstantOperand(nextInstruction) != -1) {
+			// Here it's the operator's line that matters, the constant load could never fail
+			int line = getLine(chunk, next);
+			writeChunk(vm, &optimized, (uint8_t)fusedConstantOperand(nextInstruction), line);
+			writeChunk(vm, &optimized, chunk->code[offset + 1], line);
+			offset = next + 1;
+			continue;
+		}
+
+		for (int i = 0; i < length; i++) {
+			writeChunk(vm, &optimized, chunk->code[offset + i], getLine(chunk, offset + i));
+		}
+		offset = next;
+	}
+
+	// The constant pool is untouched - only the code and its line table are swapped out
+	takeConstants(vm, &optimized, chunk);
+	freeChunk(vm, chunk);
+	*chunk = optimized;
+}
@@ -2,116 +2,116 @@
 #include "./disassemble.h"
 #include "../value/value.h"
 #include "../chunk/chunk.h"
+#include "../vm/vm.h"
 
-void disassembleChunk(Chunk* chunk, const char* name) {
-	printf("== %s ==\n", name);
+static int simpleInstruction(VM* vm, const char* name, int offset);
+static int constantInstruction(VM* vm, const char* name, Chunk* chunk, int offset);
+static int constantLongInstruction(VM* vm, const char* name, Chunk* chunk, int offset);
+static int byteInstruction(VM* vm, const char* name, Chunk* chunk, int offset);
+
+static const char* opcodeNames[] = {
+	[OP_CONSTANT]			= "OP_CONSTANT",
+	[OP_CONSTANT_LONG]		= "OP_CONSTANT_LONG",
+	[OP_NIL]				= "OP_NIL",
+	[OP_TRUE]				= "OP_TRUE",
+	[OP_FALSE]				= "OP_FALSE",
+	[OP_EQUAL]				= "OP_EQUAL",
+	[OP_GREATER]			= "OP_GREATER",
+	[OP_LESS]				= "OP_LESS",
+	[OP_ADD]				= "OP_ADD",
+	[OP_SUBTRACT]			= "OP_SUBTRACT",
+	[OP_MULTIPLY]			= "OP_MULTIPLY",
+	[OP_DIVIDE]				= "OP_DIVIDE",
+	[OP_NOT]				= "OP_NOT",
+	[OP_NEGATE]				= "OP_NEGATE",
+	[OP_RETURN]				= "OP_RETURN",
+	[OP_GET_INPUT]			= "OP_GET_INPUT",
+	[OP_NOT_EQUAL]			= "OP_NOT_EQUAL",
+	[OP_GREATER_EQUAL]		= "OP_GREATER_EQUAL",
+	[OP_LESS_EQUAL]			= "OP_LESS_EQUAL",
+	[OP_ADD_CONSTANT]		= "OP_ADD_CONSTANT",
+	[OP_SUBTRACT_CONSTANT]	= "OP_SUBTRACT_CONSTANT",
+	[OP_MULTIPLY_CONSTANT]	= "OP_MULTIPLY_CONSTANT",
+	[OP_DIVIDE_CONSTANT]	= "OP_DIVIDE_CONSTANT",
+};
+
+const char* opcodeName(uint8_t opcode) {
+	if (opcode >= OPCODE_COUNT || opcodeNames[opcode] == NULL) return "OP_UNKNOWN";
+	return opcodeNames[opcode];
+}
+
+void disassembleChunk(VM* vm, Chunk* chunk, const char* name) {
+	fprintf(vm->output, "== %s ==\n", name);
 	
 	for (int offset = 0; offset < chunk->count;) { 
-		offset = disassembleInstruction(chunk, offset);
+		offset = disassembleInstruction(vm, chunk, offset);
 	}
+
+	ConstantIndex* index = &chunk->constantIndex;
+	fprintf(vm->output, "-- constants: %d in pool, %d of %d lookups reused a slot (%.1f%%)\n",
+		chunk->constants.count, index->hits, index->lookups,
+		index->lookups == 0 ? 0.0 : 100.0 * index->hits / index->lookups);
 }
 
-int disassembleInstruction(Chunk* chunk, int offset) {
-	printf("%04d ", offset);
+int disassembleInstruction(VM* vm, Chunk* chunk, int offset) {
+	fprintf(vm->output, "%04d ", offset);
 
 	if (offset > 0 && getLine(chunk, offset) == getLine(chunk, offset - 1)) {
-		printf("	| ");
+		fprintf(vm->output, "	| ");
 	}
 	else {
-		printf("%4d ", getLine(chunk, offset));
+		fprintf(vm->output, "%4d ", getLine(chunk, offset));
 	}
+	// The switch only picks the operand layout - every name comes from opcodeNames
 	uint8_t instruction = chunk->code[offset];
+	const char* name = opcodeName(instruction);
 	switch (instruction) {
 		case OP_CONSTANT:
-			return constantInstruction("OP_CONSTANT", chunk, offset);
-		case OP_NIL: 
-			return simpleInstruction("OP_NIL", offset);
-		case OP_TRUE:
-			return simpleInstruction("OP_TRUE", offset);
-		case OP_FALSE:
-			return simpleInstruction("OP_FALSE", offset);
-		case OP_EQUAL:
-			return simpleInstruction("OP_EQUAL", offset);
-		case OP_GREATER:
-			return simpleInstruction("OP_GREATER", offset);
-		case OP_LESS:
-			return simpleInstruction("OP_LESS", offset);
+		case OP_ADD_CONSTANT:
+		case OP_SUBTRACT_CONSTANT:
+		case OP_MULTIPLY_CONSTANT:
+		case OP_DIVIDE_CONSTANT:
+			return constantInstruction(vm, name, chunk, offset);
 		case OP_CONSTANT_LONG:
-			return constantLongInstruction("OP_CONSTANT_LONG", chunk, offset);
-		case OP_ADD: 
-			return simpleInstruction("OP_ADD", offset);
-		case OP_SUBTRACT: 
-			return simpleInstruction("OP_SUBTRACT", offset);
-		case OP_MULTIPLY:
-			return simpleInstruction("OP_MULTIPLY", offset);
-		case OP_DIVIDE:
-			return simpleInstruction("OP_DIVIDE", offset);
-		case OP_NOT: 
-			return simpleInstruction("OP_NOT", offset);
-		case OP_NEGATE: 
-			return simpleInstruction("OP_NEGATAE", offset);
-		case OP_RETURN:
-			return simpleInstruction("OP_RETURN", offset);
+			return constantLongInstruction(vm, name, chunk, offset);
+		case OP_GET_INPUT:
+			return byteInstruction(vm, name, chunk, offset);
 		default:
-			printf("Unknown opcode %d\n", instruction); 
-			return offset + 1;
+			if (instruction >= OPCODE_COUNT || opcodeNames[instruction] == NULL) {
+				fprintf(vm->output, "Unknown opcode %d\n", instruction); 
+				return offset + 1;
+			}
+			return simpleInstruction(vm, name, offset);
 	}
 } 
 
-static int simpleInstruction(const char* name, int offset) {
-	printf("%s\n", name);
+static int simpleInstruction(VM* vm, const char* name, int offset) {
+	fprintf(vm->output, "%s\n", name);
 	return offset + 1;
 } 
 
-static int constantInstruction(const char* name, Chunk* chunk, int offset ) {
+static int constantInstruction(VM* vm, const char* name, Chunk* chunk, int offset ) {
 	uint8_t constantIndex = chunk->code[offset + 1]; // index 0 is the opcode and +1 is the operand (which is an index)
-	printf("%-16s %4d '", name, constantIndex);
-	printValue(chunk->constants.values[constantIndex]);
-	printf("'\n");
+	fprintf(vm->output, "%-16s %4d '", name, constantIndex);
+	printValue(vm, chunk->constants.values[constantIndex]);
+	fprintf(vm->output, "'\n");
 	return offset + 2;
 }
 
-static int binaryToDec(int binary) {
+static int constantLongInstruction(VM* vm, const char* name, Chunk* chunk, int offset) {
 	
-	int decimal_num = 0;
-	int base = 1;
-	int rem;
+	// The 3 byte index is stored least significant byte first
+	int constantIndex = chunk->code[offset + 1] |
+		(chunk->code[offset + 2] << 8) |
+		(chunk->code[offset + 3] << 16);
 
-	while (binary > 0) {
-		rem = binary % 10;
-		decimal_num = decimal_num + rem * base;
-		binary /= 10;
-		base *= 2;
-	} 
-
-	return decimal_num;
-}
-
-static int constantLongInstruction(const char* name, Chunk* chunk, int offset) {
-	
-	// Getting the 3 byte index
-	uint8_t byteArr[3];
-	byteArr[0] = chunk->code[offset + 1]; 
-	byteArr[1] = chunk->code[offset + 2];
-	byteArr[2] = chunk->code[offset + 3]; 
-	
-	// Converting the 3 byte index into binary
-	char buffer1[9], buffer2[9], buffer3[9]; // 9 = 8 bit + 1
-	char dest[28]; // 28 = (9 + 9 + 9) + 1
-
-	_itoa_s(byteArr[2], buffer3, 9, 2);
-	_itoa_s(byteArr[1], buffer2, 9, 2);
-	_itoa_s(byteArr[0], buffer1, 9, 2);
-
-	// Concatenate the binary values and converting to a decimal integer (the index)
- 	strcpy_s(dest, 28, buffer3);
-	strcat_s(dest, 28, buffer2);
-	strcat_s(dest, 28, buffer1);
-	
-	int constantIndex = binaryToDec(atoi(dest));
-
-	printf("%-16s %4d '", name, constantIndex);
-	printValue(chunk->constants.values[constantIndex]);
-	printf("'\n");
+	fprintf(vm->output, "%-16s %4d '", name, constantIndex);
+	printValue(vm, chunk->constants.values[constantIndex]);
+	fprintf(vm->output, "'\n");
 	return offset + 4;
-}
\ No newline at end of file
+}
+static int byteInstruction(VM* vm, const char* name, Chunk* chunk, int offset) {
+	uint8_t slot = chunk->code[offset + 1];
+	fprintf(vm->output, "%-16s %4d\n", name, slot);
+	return offset + 2;
+}
@@ -3,7 +3,8 @@
 
 #include "../chunk//chunk.h"
 
-void disassembleChunk(Chunk* chunk, const char* name);
-int disassembleInstruction(Chunk* chunk, int offset);
+void disassembleChunk(VM* vm, Chunk* chunk, const char* name);
+int disassembleInstruction(VM* vm, Chunk* chunk, int offset);
+const char* opcodeName(uint8_t opcode);
 
 #endif
@@ -0,0 +1,204 @@
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS and madvise are hidden in strict C builds otherwise
+#endif
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "file.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#include <process.h>
+#define getpid _getpid
+#define mkdir(path, mode) _mkdir(path)
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char emptyFile[SOURCE_PADDING] = { 0 }; // empty files can't be mapped
+
+#ifdef _WIN32
+static bool copyFile(const char* path, MappedFile* file, size_t padding) {
+	// Fallback for when the padding can't be mapped - reads the file into a zero padded heap block
+	FILE* stream = fopen(path, "rb");
+	if (stream == NULL) return false;
+
+	fseek(stream, 0L, SEEK_END);
+	long size = ftell(stream);
+	rewind(stream);
+
+	char* bytes = size < 0 ? NULL : (char*)calloc((size_t)size + padding, 1);
+	if (bytes == NULL || fread(bytes, 1, (size_t)size, stream) < (size_t)size) {
+		free(bytes);
+		fclose(stream);
+		return false;
+	}
+	fclose(stream);
+
+	file->bytes = bytes;
+	file->size = (size_t)size;
+	file->copied = true;
+	return true;
+}
+#endif
+
+static bool openMapping(const char* path, MappedFile* file, size_t padding) {
+	file->bytes = NULL;
+	file->size = 0;
+	file->mappedSize = 0;
+	file->copied = false;
+
+#ifdef _WIN32
+	if (padding > 0) return copyFile(path, file, padding);
+
+	HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, NULL);
+	if (handle == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(handle, &size)) {
+		CloseHandle(handle);
+		return false;
+	}
+
+	file->size = (size_t)size.QuadPart;
+	if (file->size == 0) {
+		CloseHandle(handle);
+		file->bytes = emptyFile;
+		return true;
+	}
+
+	// The view keeps the mapping (and the file) alive on its own, so both handles can go
+	HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(handle);
+	if (mapping == NULL) return false;
+
+	file->bytes = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	file->mappedSize = file->size;
+	CloseHandle(mapping);
+	return file->bytes != NULL;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		close(fd);
+		return false;
+	}
+
+	file->size = (size_t)info.st_size;
+	if (file->size == 0) {
+		close(fd);
+		file->bytes = emptyFile;
+		return true;
+	}
+
+	// For padded mappings the whole range is reserved as anonymous zero pages first and the file is laid
+	// over the start of it. The rest of the file's last page is zero filled by the kernel, and if the file
+	// ends exactly on a page boundary the padding is the anonymous page after it
+	size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+	size_t mappedSize = padding == 0 ? file->size : (file->size + padding + pageSize - 1) / pageSize * pageSize;
+	void* region = NULL;
+	if (padding > 0) {
+		region = mmap(NULL, mappedSize, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (region == MAP_FAILED) {
+			close(fd);
+			return false;
+		}
+	}
+
+	// The mapping holds its own reference to the file, so the descriptor can be closed straight away
+	void* bytes = mmap(region, file->size, PROT_READ, MAP_PRIVATE | (region != NULL ? MAP_FIXED : 0), fd, 0);
+	close(fd);
+	if (bytes == MAP_FAILED) {
+		if (region != NULL) munmap(region, mappedSize);
+		return false;
+	}
+
+	file->bytes = (const char*)bytes;
+	file->mappedSize = mappedSize;
+	return true;
+#endif
+}
+
+bool mapFile(const char* path, MappedFile* file) {
+	return openMapping(path, file, 0);
+}
+
+bool mapSourceFile(const char* path, MappedFile* file) {
+	// Source is used straight from the page cache, so a large script is never held twice in memory
+	if (!openMapping(path, file, SOURCE_PADDING)) return false;
+
+#if !defined(_WIN32) && defined(MADV_SEQUENTIAL)
+	if (file->mappedSize > 0) madvise((void*)file->bytes, file->size, MADV_SEQUENTIAL); // the scanner reads it front to back
+#endif
+	return true;
+}
+
+void unmapFile(MappedFile* file) {
+	if (file->copied) {
+		free((void*)file->bytes);
+	}
+	else if (file->mappedSize > 0) {
+#ifdef _WIN32
+		UnmapViewOfFile(file->bytes);
+#else
+		munmap((void*)file->bytes, file->mappedSize);
+#endif
+	}
+
+	file->bytes = NULL;
+	file->size = 0;
+	file->mappedSize = 0;
+	file->copied = false;
+}
+
+FILE* openTempFile(const char* path, char* tempPath) {
+	// A uniquely named sibling of path (tempPath must hold FILE_PATH_MAX chars). The pid keeps
+	// concurrent processes apart and the counter keeps repeated writes in one process (on any thread) apart
+	static atomic_uint counter;
+	int length = snprintf(tempPath, FILE_PATH_MAX, "%s.%d.%u.tmp", path, (int)getpid(), atomic_fetch_add(&counter, 1));
+	if (length < 0 || length >= FILE_PATH_MAX) return NULL;
+	return fopen(tempPath, "wb");
+}
+
+bool commitTempFile(FILE* file, const char* tempPath, const char* path) {
+	// Readers see either the old file or the complete new one, never a partial write. Renaming over
+	// an existing file is atomic on POSIX, and whoever renames last simply wins
+	bool failed = ferror(file);
+	if (fclose(file) != 0) failed = true; // fclose flushes, so a full disk only shows up here
+
+#ifdef _WIN32
+	if (!failed) failed = !MoveFileExA(tempPath, path, MOVEFILE_REPLACE_EXISTING);
+#else
+	if (!failed) failed = rename(tempPath, path) != 0;
+#endif
+
+	if (failed) remove(tempPath);
+	return !failed;
+}
+
+bool makeDirectories(const char* path) {
+	// mkdir -p. Failures along the way are ignored (the parent may exist, or be a drive like "C:"),
+	// only whether the full path ends up existing matters
+	char partial[FILE_PATH_MAX];
+	size_t length = strlen(path);
+	if (length >= FILE_PATH_MAX) return false;
+	memcpy(partial, path, length + 1);
+
+	for (size_t i = 1; i < length; i++) {
+		if (partial[i] != '/' && partial[i] != '\\') continue;
+
+		partial[i] = '\0';
+		mkdir(partial, 0755);
+		partial[i] = path[i];
+	}
+	return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
@@ -0,0 +1,27 @@
+#ifndef clox_file_h
+#define clox_file_h
+
+#include <stdio.h>
+#include "../common.h"
+
+// Zero bytes that always follow a mapped source file - the scanner's NUL terminator plus room to read ahead
+#define SOURCE_PADDING 64
+
+typedef struct {
+	// A read-only view of a whole file - release it with unmapFile(), never free the bytes directly
+	const char* bytes;
+	size_t size;
+	size_t mappedSize;	// the whole mapping including padding, 0 when nothing is mapped
+	bool copied;		// bytes is a heap copy on platforms that can't map the padding
+} MappedFile;
+
+#define FILE_PATH_MAX 4096
+
+bool mapFile(const char* path, MappedFile* file);
+bool mapSourceFile(const char* path, MappedFile* file);
+void unmapFile(MappedFile* file);
+FILE* openTempFile(const char* path, char* tempPath);
+bool commitTempFile(FILE* file, const char* tempPath, const char* path);
+bool makeDirectories(const char* path);
+
+#endif
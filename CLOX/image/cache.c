@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "../file/file.h"
+
+static bool cachePath(const char* directory, const char* source, uint8_t* digest, char* path) {
+	// The file name only narrows it down to one entry - the full digest in its header decides a hit
+	size_t length = strlen(source);
+	sha256(source, length, digest);
+	uint64_t prefix = 0;
+	for (int i = 0; i < 8; i++) prefix = prefix << 8 | digest[i];
+	int written = snprintf(path, FILE_PATH_MAX, "%s/%016llx-%zx-v%d.loxc", directory,
+		(unsigned long long)prefix, length, IMAGE_VERSION);
+	return written > 0 && written < FILE_PATH_MAX;
+}
+
+bool loadCachedImage(VM* vm, const char* directory, const char* source, Image* image) {
+	// A missing, stale, damaged or colliding entry is just a miss - the caller compiles and stores a fresh one
+	char path[FILE_PATH_MAX];
+	uint8_t digest[DIGEST_SIZE];
+	if (!cachePath(directory, source, digest, path)) return false;
+	return loadImage(vm, path, image, false, digest);
+}
+
+void storeCachedImage(const char* directory, const char* source, Chunk* chunk) {
+	// Best effort - a read-only or full cache directory only costs us the next compile
+	char path[FILE_PATH_MAX];
+	uint8_t digest[DIGEST_SIZE];
+	if (!cachePath(directory, source, digest, path)) return;
+	if (!makeDirectories(directory)) return;
+	writeImage(chunk, path, digest);
+}
+
+const char* defaultCacheDirectory(char* directory) {
+	// CLOX_CACHE_DIR wins, otherwise the platform's per-user cache location built in directory
+	// (FILE_PATH_MAX chars). NULL disables caching
+	const char* override = getenv("CLOX_CACHE_DIR");
+	if (override != NULL) return override[0] == '\0' ? NULL : override;
+
+	int written = -1;
+#ifdef _WIN32
+	const char* base = getenv("LOCALAPPDATA");
+	if (base != NULL) written = snprintf(directory, FILE_PATH_MAX, "%s\\clox", base);
+#else
+	const char* base = getenv("XDG_CACHE_HOME");
+	const char* home = getenv("HOME");
+	if (base != NULL && base[0] != '\0') written = snprintf(directory, FILE_PATH_MAX, "%s/clox", base);
+	else if (home != NULL) written = snprintf(directory, FILE_PATH_MAX, "%s/.cache/clox", home);
+#endif
+
+	return written > 0 && written < FILE_PATH_MAX ? directory : NULL;
+}
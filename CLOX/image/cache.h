@@ -0,0 +1,11 @@
+#ifndef clox_cache_h
+#define clox_cache_h
+
+#include "../common.h"
+#include "image.h"
+
+bool loadCachedImage(VM* vm, const char* directory, const char* source, Image* image);
+void storeCachedImage(const char* directory, const char* source, Chunk* chunk);
+const char* defaultCacheDirectory(char* directory);
+
+#endif
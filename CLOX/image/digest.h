@@ -0,0 +1,11 @@
+#ifndef clox_digest_h
+#define clox_digest_h
+
+#include "../common.h"
+
+#define DIGEST_SIZE 32
+
+// SHA-256 of length bytes. Used to tell whether a cached image was compiled from exactly this source
+void sha256(const char* bytes, size_t length, uint8_t digest[DIGEST_SIZE]);
+
+#endif
@@ -0,0 +1,184 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "image.h"
+#include "verifier.h"
+#include "../memory/memory.h"
+#include "../objects/objects.h"
+#include "../vm/vm.h"
+
+#define IMAGE_MAGIC "LOXC"
+#define IMAGE_BYTE_ORDER 0x01020304u // reads back differently on a machine with the other endianness
+
+#define CONSTANT_NUMBER 'n'
+#define CONSTANT_STRING 's'
+
+typedef struct {
+	// Followed by the code, padding up to a multiple of 4, the LineStart table and the constant pool.
+	// Everything is stored in the byte order of the machine that compiled it
+	char magic[4];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t codeCount;
+	uint32_t linesCount;
+	uint32_t constantCount;
+	uint32_t constantsSize; // bytes taken by the serialized constant pool
+	uint32_t maxStackDepth;
+	uint8_t sourceDigest[DIGEST_SIZE]; // all zero when the image wasn't written for the compile cache
+} ImageHeader;
+
+static size_t codeSize(uint32_t codeCount) {
+	// Padding keeps the line table 4 byte aligned inside the (page aligned) mapping
+	return (codeCount + 3) & ~(size_t)3;
+}
+
+static void writeConstant(FILE* file, Value value) {
+	// Constants are written by type rather than as raw Values so images work with and without NAN_BOXING
+	if (IS_NUMBER(value)) {
+		double number = AS_NUMBER(value);
+		fputc(CONSTANT_NUMBER, file);
+		fwrite(&number, sizeof(double), 1, file);
+	}
+	else {
+		ObjString* string = AS_STRING(value);
+		uint32_t length = (uint32_t)string->length;
+		fputc(CONSTANT_STRING, file);
+		fwrite(&length, sizeof(uint32_t), 1, file);
+		fwrite(string->chars, sizeof(char), string->length, file);
+	}
+}
+
+static uint32_t constantSize(Value value) {
+	if (IS_NUMBER(value)) return 1 + sizeof(double);
+	return 1 + sizeof(uint32_t) + (uint32_t)AS_STRING(value)->length;
+}
+
+bool writeImage(Chunk* chunk, const char* path, const uint8_t* sourceDigest) {
+	// Written next to path and renamed into place, so a reader (or the compile cache in another
+	// process) can never map a half-written image
+	char tempPath[FILE_PATH_MAX];
+	FILE* file = openTempFile(path, tempPath);
+	if (file == NULL) return false;
+
+	ImageHeader header;
+	memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+	header.version = IMAGE_VERSION;
+	header.byteOrder = IMAGE_BYTE_ORDER;
+	header.codeCount = (uint32_t)chunk->count;
+	header.linesCount = (uint32_t)chunk->linesCount;
+	header.constantCount = (uint32_t)chunk->constants.count;
+	header.constantsSize = 0;
+	for (int i = 0; i < chunk->constants.count; i++) header.constantsSize += constantSize(chunk->constants.values[i]);
+	header.maxStackDepth = (uint32_t)chunk->maxStackDepth;
+	if (sourceDigest != NULL) memcpy(header.sourceDigest, sourceDigest, DIGEST_SIZE);
+	else memset(header.sourceDigest, 0, DIGEST_SIZE);
+
+	static const uint8_t padding[3] = { 0, 0, 0 };
+	fwrite(&header, sizeof(ImageHeader), 1, file);
+	fwrite(chunk->code, sizeof(uint8_t), chunk->count, file);
+	fwrite(padding, sizeof(uint8_t), codeSize(header.codeCount) - header.codeCount, file);
+	fwrite(chunk->lines, sizeof(LineStart), chunk->linesCount, file);
+	for (int i = 0; i < chunk->constants.count; i++) writeConstant(file, chunk->constants.values[i]);
+
+	return commitTempFile(file, tempPath, path);
+}
+
+static bool readConstants(VM* vm, Chunk* chunk, const char* bytes, const char* end, uint32_t count) {
+	for (uint32_t i = 0; i < count; i++) {
+		if (bytes >= end) return false;
+		char type = *bytes++;
+
+		if (type == CONSTANT_NUMBER) {
+			if ((size_t)(end - bytes) < sizeof(double)) return false;
+			double number;
+			memcpy(&number, bytes, sizeof(double)); // the pool is not aligned
+			bytes += sizeof(double);
+			// With NAN_BOXING some NaN payloads are the bit patterns of object pointers and tags, so
+			// every NaN is loaded as the plain quiet NaN
+			if (number != number) number = NAN;
+			writeValueArray(vm, &chunk->constants, NUMBER_VAL(number));
+		}
+		else if (type == CONSTANT_STRING) {
+			uint32_t length;
+			if ((size_t)(end - bytes) < sizeof(uint32_t)) return false;
+			memcpy(&length, bytes, sizeof(uint32_t));
+			bytes += sizeof(uint32_t);
+			if ((size_t)(end - bytes) < length) return false;
+
+			// Strings have to be interned like any other, so these are the only bytes that get copied
+			writeValueArray(vm, &chunk->constants, OBJ_VAL(copyString(vm, bytes, (int)length)));
+			bytes += length;
+		}
+		else {
+			return false;
+		}
+	}
+	return bytes == end;
+}
+
+static bool readImage(VM* vm, Image* image, bool reportErrors, const uint8_t* sourceDigest) {
+	const char* bytes = image->file.bytes;
+	size_t size = image->file.size;
+
+	ImageHeader header;
+	if (size < sizeof(ImageHeader)) return false;
+	memcpy(&header, bytes, sizeof(ImageHeader));
+	if (memcmp(header.magic, IMAGE_MAGIC, sizeof(header.magic)) != 0) return false;
+
+	if (header.byteOrder != IMAGE_BYTE_ORDER) {
+		if (reportErrors) fprintf(vm->errorOutput, "Image was compiled on a machine with a different byte order.\n");
+		return false;
+	}
+	if (header.version != IMAGE_VERSION) {
+		if (reportErrors) fprintf(vm->errorOutput, "Image version %u does not match this interpreter (version %d).\n",
+			header.version, IMAGE_VERSION);
+		return false;
+	}
+	if (sourceDigest != NULL && memcmp(header.sourceDigest, sourceDigest, DIGEST_SIZE) != 0) return false;
+
+	// Every section has to fit in the file - done in size_t so large counts can't wrap around
+	size_t linesOffset = sizeof(ImageHeader) + codeSize(header.codeCount);
+	size_t constantsOffset = linesOffset + (size_t)header.linesCount * sizeof(LineStart);
+	if (header.codeCount > INT32_MAX || header.linesCount > INT32_MAX || header.maxStackDepth > INT32_MAX ||
+		constantsOffset > size || size - constantsOffset != header.constantsSize) {
+		return false;
+	}
+
+	// The code and line table are used in place - the VM never writes to either
+	Chunk* chunk = &image->chunk;
+	chunk->code = (uint8_t*)(bytes + sizeof(ImageHeader));
+	chunk->count = (int)header.codeCount;
+	chunk->lines = (LineStart*)(bytes + linesOffset);
+	chunk->linesCount = (int)header.linesCount;
+	chunk->maxStackDepth = (int)header.maxStackDepth;
+
+	return readConstants(vm, chunk, bytes + constantsOffset, bytes + size, header.constantCount);
+}
+
+bool loadImage(VM* vm, const char* path, Image* image, bool reportErrors, const uint8_t* sourceDigest) {
+	initChunk(&image->chunk);
+	if (!mapFile(path, &image->file)) {
+		if (reportErrors) fprintf(vm->errorOutput, "Could not open file \"%s\".\n", path);
+		return false;
+	}
+
+	if (!readImage(vm, image, reportErrors, sourceDigest)) {
+		if (reportErrors) fprintf(vm->errorOutput, "\"%s\" is not a valid compiled script.\n", path);
+		freeImage(vm, image);
+		return false;
+	}
+
+	if (!verifyChunk(vm, &image->chunk, reportErrors)) {
+		freeImage(vm, image);
+		return false;
+	}
+	return true;
+}
+
+void freeImage(VM* vm, Image* image) {
+	// Only the constant pool was allocated - the rest belongs to the mapping
+	freeValueArray(vm, &image->chunk.constants);
+	initChunk(&image->chunk);
+	unmapFile(&image->file);
+}
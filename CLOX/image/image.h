@@ -0,0 +1,25 @@
+#ifndef clox_image_h
+#define clox_image_h
+
+#include "../common.h"
+#include "../chunk/chunk.h"
+#include "../file/file.h"
+#include "digest.h"
+
+// Bump whenever the layout or the meaning of any opcode changes - older images are then rejected
+#define IMAGE_VERSION 3
+
+typedef struct {
+	// A compiled chunk loaded from a .loxc file. The code and line table point straight into
+	// the mapped file, so the chunk must be released with freeImage() and never freeChunk()
+	Chunk chunk;
+	MappedFile file;
+} Image;
+
+// sourceDigest is the sha256() of the source the chunk was compiled from, or NULL when it doesn't matter.
+// loadImage() then rejects an image written for any other source
+bool writeImage(Chunk* chunk, const char* path, const uint8_t* sourceDigest);
+bool loadImage(VM* vm, const char* path, Image* image, bool reportErrors, const uint8_t* sourceDigest);
+void freeImage(VM* vm, Image* image);
+
+#endif
@@ -0,0 +1,83 @@
+#include <stdio.h>
+
+#include "verifier.h"
+#include "../objects/objects.h"
+#include "../vm/vm.h"
+
+static bool invalid(VM* vm, bool reportErrors, const char* message, int offset) {
+	if (reportErrors) fprintf(vm->errorOutput, "Invalid bytecode at offset %d: %s\n", offset, message);
+	return false;
+}
+
+bool verifyChunk(VM* vm, Chunk* chunk, bool reportErrors) {
+	// run() trusts its input - it reads operands without bounds checks and never checks for stack
+	// room beyond maxStackDepth - so anything that didn't come from our own compiler has to pass this first
+	if (chunk->count == 0) return invalid(vm, reportErrors, "chunk is empty", 0);
+
+	int depth = 0;
+	int deepest = 0;
+	int offset = 0;
+	uint8_t instruction = OP_RETURN;
+	while (offset < chunk->count) {
+		instruction = chunk->code[offset];
+		if (instruction >= OPCODE_COUNT) return invalid(vm, reportErrors, "unknown opcode", offset);
+
+		int length = instructionLength(instruction);
+		if (offset + length > chunk->count) return invalid(vm, reportErrors, "operand runs past the end of the code", offset);
+
+		int constant = -1;
+		switch (instruction) {
+			case OP_CONSTANT:
+			case OP_ADD_CONSTANT:
+			case OP_SUBTRACT_CONSTANT:
+			case OP_MULTIPLY_CONSTANT:
+			case OP_DIVIDE_CONSTANT:
+				constant = chunk->code[offset + 1];
+				break;
+			case OP_CONSTANT_LONG:
+				constant = chunk->code[offset + 1] | (chunk->code[offset + 2] << 8) | (chunk->code[offset + 3] << 16);
+				break;
+			default:
+				break;
+		}
+		if (constant >= chunk->constants.count) return invalid(vm, reportErrors, "constant index out of range", offset);
+		if (instruction == OP_GET_INPUT && chunk->code[offset + 1] >= chunk->inputCount) {
+			return invalid(vm, reportErrors, "input index out of range", offset);
+		}
+
+		if (depth < stackInputs(instruction)) return invalid(vm, reportErrors, "stack underflow", offset);
+		depth += stackEffect(instruction);
+		if (depth > chunk->maxStackDepth) return invalid(vm, reportErrors, "stack grows past maxStackDepth", offset);
+		if (depth > deepest) deepest = depth;
+
+		// There are no jumps, so the last instruction has to be the one that leaves run()
+		if (instruction == OP_RETURN && offset + length != chunk->count) {
+			return invalid(vm, reportErrors, "code after OP_RETURN", offset);
+		}
+		offset += length;
+	}
+
+	if (instruction != OP_RETURN) return invalid(vm, reportErrors, "chunk does not end with OP_RETURN", chunk->count);
+	// The stack is allocated up front from maxStackDepth, so a header can't ask for more than the code uses.
+	// The compiler works it out with the same walk, so its images always match exactly
+	if (deepest != chunk->maxStackDepth) return invalid(vm, reportErrors, "maxStackDepth does not match the code", 0);
+
+	for (int i = 0; i < chunk->constants.count; i++) {
+		Value value = chunk->constants.values[i];
+		if (!IS_NUMBER(value) && !IS_STRING(value)) {
+			if (reportErrors) fprintf(vm->errorOutput, "Invalid bytecode: constant %d is not a number or string\n", i);
+			return false;
+		}
+	}
+
+	// getLine() binary searches the line table, so it must be sorted and start at offset 0
+	for (int i = 0; i < chunk->linesCount; i++) {
+		int lineOffset = chunk->lines[i].offset;
+		if (lineOffset < 0 || lineOffset >= chunk->count || (i == 0 && lineOffset != 0) ||
+			(i > 0 && lineOffset <= chunk->lines[i - 1].offset)) {
+			return invalid(vm, reportErrors, "line table out of order", lineOffset);
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,9 @@
+#ifndef clox_verifier_h
+#define clox_verifier_h
+
+#include "../chunk/chunk.h"
+
+// Problems go to vm->errorOutput when reportErrors is set
+bool verifyChunk(VM* vm, Chunk* chunk, bool reportErrors);
+
+#endif
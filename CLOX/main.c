@@ -5,83 +5,266 @@
 #include "chunk/chunk.h"
 #include "./disassemmbler/disassemble.h"
 #include "./vm/vm.h"
+#include "./compiler/compiler.h"
+#include "./image/image.h"
+#include "./image/cache.h"
+#include "./file/file.h"
+#include "./batch/batch.h"
 
-static void repl() {
+static char* readLine(char** buffer, size_t* capacity) {
+	// Reads a whole line of any length, growing the buffer as needed. NULL once stdin is exhausted
+	size_t length = 0;
+	for (;;) {
+		if (*capacity - length < 2) {
+			size_t newCapacity = *capacity < 256 ? 256 : *capacity * 2;
+			char* grown = (char*)realloc(*buffer, newCapacity);
+			if (grown == NULL) {
+				fprintf(stderr, "Not enough memory to read the line.\n");
+				exit(74);
+			}
+			*buffer = grown;
+			*capacity = newCapacity;
+		}
+
+		if (!fgets(*buffer + length, (int)(*capacity - length), stdin)) { // null pointer is returned if nothing is read
+			return length > 0 ? *buffer : NULL;
+		}
+
+		length += strlen(*buffer + length);
+		if ((*buffer)[length - 1] == '\n') return *buffer;
+	}
+}
+
+static void repl(VM* vm) {
 
-	char line[1024]; // arrays decay into pointers by the compiler
+	char* line = NULL;
+	size_t capacity = 0;
 	for (;;) {
 		printf("> "); 
 
-		if (!fgets(line, sizeof(line), stdin)) { // null pointer is returned if nothing is read 
+		if (!readLine(&line, &capacity)) {
 			printf("\n");
 			break;
 		}
 		
-		interpret(line);
+		interpret(vm, line);
 	}
+	free(line);
 } 
 
-static char* readFile(const char* path) {
-	// 'b' opens in binary mode and disables handling of newlines
-	FILE* file;
-
-	fopen_s(&file, path, "rb");
-
-	if (file == NULL) {
+static MappedFile readFile(const char* path) {
+	// The file is mapped rather than read, and comes with the NUL terminator the scanner stops at
+	MappedFile file;
+	if (!mapSourceFile(path, &file)) {
 		fprintf(stderr, "Could not open file \"%s\".\n", path);
 		exit(74);
 	}
+	return file;
+}
+
+static void printStats(VM* vm) {
+	// One JSON object on stderr so the benchmark harness can read it without parsing program output
+	VMStats* stats = &vm->stats;
+	fprintf(stderr,
+		"{\"source_bytes\": %d, \"compile_ns\": %llu, \"run_ns\": %llu, \"instructions\": %d, "
+		"\"allocations\": %zu, \"peak_bytes\": %zu, \"collections\": %zu, \"minor_collections\": %zu, "
+		"\"gc_pause_ns\": %llu, \"max_gc_pause_ns\": %llu, \"cache_hit\": %s}\n",
+		stats->sourceBytes, (unsigned long long)stats->compileNanos, (unsigned long long)stats->runNanos,
+		stats->instructionsExecuted, stats->allocations, stats->peakBytesAllocated,
+		stats->collections, stats->minorCollections, (unsigned long long)stats->gcPauseNanos,
+		(unsigned long long)stats->maxGcPauseNanos, stats->cacheHit ? "true" : "false");
+}
 
-	// Find the file size
-	fseek(file, 0L, SEEK_END); 
-	size_t fileSize = ftell(file);
-	rewind(file); 
+static void endRun(VM* vm, InterpretResult result, bool showStats) {
+	if (showStats) printStats(vm);
+	if (vm->debug.profile != NULL) printProfile(vm->debug.profile, stderr);
 
-	// Reads file contents to buffer
-	char* buffer = (char*)malloc(fileSize + 1); // + 1 for the null terminator
-	if (buffer == NULL) {
-		fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
+	if (result == INTERPRET_COMPILE_ERROR) exit(65);
+	if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+}
+
+static void runFile(VM* vm, const char* path, bool showStats) {
+	MappedFile source = readFile(path);
+	InterpretResult result = interpret(vm, source.bytes);
+	unmapFile(&source);
+
+	endRun(vm, result, showStats);
+}
+
+static void runImage(VM* vm, const char* path, bool showStats) {
+	// Compiled images skip the scanner and compiler entirely - see --compile
+	Image image;
+	if (!loadImage(vm, path, &image, true, NULL)) exit(65);
+
+	InterpretResult result = interpretChunk(vm, &image.chunk);
+	freeImage(vm, &image);
+
+	endRun(vm, result, showStats);
+}
+
+static void compileFile(VM* vm, const char* path, const char* outputPath) {
+	MappedFile source = readFile(path);
+	Chunk chunk;
+	initChunk(&chunk);
+
+	bool compiled = compile(vm, source.bytes, &chunk);
+	unmapFile(&source);
+	if (!compiled) exit(65);
+
+	if (!writeImage(&chunk, outputPath, NULL)) {
+		fprintf(stderr, "Could not write \"%s\".\n", outputPath);
 		exit(74);
-	} 
+	}
+	freeChunk(vm, &chunk);
+}
 
-	size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
-	if (bytesRead < fileSize) {
-		fprintf(stderr, "Could not read file \"%s\".\n", path);
+static int runJobs(VM* vm, const char** paths, int pathCount, const char* manifestPath, int jobs) {
+	// The scripts named on the command line followed by the ones in the manifest, see batch.h
+	char* manifest = NULL;
+	const char** manifestPaths = NULL;
+	int manifestCount = 0;
+	if (manifestPath != NULL && !readManifest(manifestPath, &manifest, &manifestPaths, &manifestCount)) {
+		fprintf(stderr, "Could not read manifest \"%s\".\n", manifestPath);
 		exit(74);
 	}
-		
-	buffer[bytesRead] = '\0'; // string needs a null terminator
 
-	fclose(file);
-	return buffer;
+	const char** scripts = (const char**)malloc(sizeof(const char*) * (pathCount + manifestCount + 1));
+	if (scripts == NULL) exit(74);
+	memcpy((void*)scripts, (void*)paths, sizeof(const char*) * pathCount);
+	if (manifestCount > 0) memcpy((void*)(scripts + pathCount), (void*)manifestPaths, sizeof(const char*) * manifestCount);
+
+	BatchOptions options;
+	options.threadCount = jobs;
+	options.cacheDirectory = vm->cacheDirectory;
+	options.lexThreads = vm->lexThreads;
+	options.printCode = vm->debug.printCode;
+	options.stressGC = vm->debug.stressGC;
+	options.markThreads = vm->markThreads;
+	int exitCode = runBatch(scripts, pathCount + manifestCount, &options);
+
+	free((void*)scripts);
+	free((void*)manifestPaths);
+	free(manifest);
+	return exitCode;
 }
 
-static void runFile(const char* path) {
-	char* source = readFile(path); // dynamically allocates the string
-	InterpretResult result = interpret(source);
-	free(source); 
+static bool hasExtension(const char* path, const char* extension) {
+	size_t pathLength = strlen(path);
+	size_t extensionLength = strlen(extension);
+	return pathLength >= extensionLength && strcmp(path + pathLength - extensionLength, extension) == 0;
+}
 
-	if (result == INTERPRET_COMPILE_ERROR) exit(65);
-	if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+static void usage() {
+	// stderr not buffered so displayed immediately
+	fprintf(stderr, "Usage: clox [--stats] [--profile] [--trace] [--disassemble] [--cache] [--no-fold] [--stress-gc]\n"
+		"            [--lex-threads N] [--mark-threads N] [path]\n");
+	fprintf(stderr, "       clox --jobs N [--disassemble] [--cache] [--no-fold] [--stress-gc] [--lex-threads N]\n"
+		"            [--mark-threads N] [--manifest file] path...\n");
+	fprintf(stderr, "       clox --compile path -o output.loxc\n");
+	exit(64);
 }
 
 int main(int argc, const char* argv[]) {
 
-	initVM();
-	
-	if (argc == 1) {
-		repl(); 
+	VM vm;
+	initVM(&vm);
+
+	const char** paths = (const char**)malloc(sizeof(const char*) * argc);
+	int pathCount = 0;
+	const char* manifestPath = NULL;
+	const char* outputPath = NULL;
+	int jobs = 0;
+	bool compileOnly = false;
+	bool showStats = false;
+	bool useCache = false; // opt in - nothing evicts entries, and every lookup hashes the whole source
+	char cacheDirectory[FILE_PATH_MAX];
+	Profile profile;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--stats") == 0) {
+			showStats = true;
+			vm.debug.measure = true;
+		}
+		else if (strcmp(argv[i], "--profile") == 0) {
+			initProfile(&profile);
+			vm.debug.profile = &profile;
+		}
+		else if (strcmp(argv[i], "--trace") == 0) {
+			vm.debug.traceExecution = true;
+		}
+		else if (strcmp(argv[i], "--disassemble") == 0) {
+			vm.debug.printCode = true;
+		}
+		else if (strcmp(argv[i], "--stress-gc") == 0) {
+			vm.debug.stressGC = true;
+		}
+		else if (strcmp(argv[i], "--mark-threads") == 0 && i + 1 < argc) {
+			vm.markThreads = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--lex-threads") == 0 && i + 1 < argc) {
+			vm.lexThreads = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--cache") == 0) {
+			useCache = true;
+		}
+		else if (strcmp(argv[i], "--no-cache") == 0) {
+			useCache = false; // the default now - still accepted for scripts that pass it
+		}
+		else if (strcmp(argv[i], "--no-fold") == 0) {
+			vm.debug.noFolding = true;
+		}
+		else if (strcmp(argv[i], "--compile") == 0) {
+			compileOnly = true;
+		}
+		else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			outputPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+			jobs = atoi(argv[++i]);
+			if (jobs < 1) usage();
+		}
+		else if (strcmp(argv[i], "--manifest") == 0 && i + 1 < argc) {
+			manifestPath = argv[++i];
+		}
+		else if (paths != NULL && argv[i][0] != '-') {
+			paths[pathCount++] = argv[i];
+		}
+		else {
+			usage();
+		}
 	}
-	else if (argc == 2) {
-		runFile(argv[1]);
-	} 
-	else {
-		fprintf(stderr, "Usage: clox [path]\n"); // stderr not buffered so displayed immediately
-		exit(64);
+	const char* path = pathCount > 0 ? paths[0] : NULL;
+	if (compileOnly != (outputPath != NULL) || (compileOnly && path == NULL)) usage();
+	if (useCache && vm.debug.noFolding) usage(); // cached images were compiled with folding
+
+	// A batch is its own mode - the per-run reports and the REPL only make sense for a single script
+	bool batch = jobs > 0;
+	if (batch && (compileOnly || showStats || vm.debug.profile != NULL || vm.debug.traceExecution)) usage();
+	if (!batch && (pathCount > 1 || manifestPath != NULL)) usage();
+	if (batch && useCache) vm.cacheDirectory = defaultCacheDirectory(cacheDirectory);
+
+	int exitCode = 0;
+	if (batch) {
+		exitCode = runJobs(&vm, paths, pathCount, manifestPath, jobs);
+	}
+	else if (compileOnly) {
+		compileFile(&vm, path, outputPath);
+	}
+	else if (path == NULL) {
+		repl(&vm); 
+		if (vm.debug.profile != NULL) printProfile(vm.debug.profile, stderr);
+	}
+	else if (hasExtension(path, ".loxc")) {
+		runImage(&vm, path, showStats);
 	}
+	else {
+		// Only whole files are cached - REPL lines are too short to be worth a file each
+		if (useCache) vm.cacheDirectory = defaultCacheDirectory(cacheDirectory);
+		runFile(&vm, path, showStats);
+	} 
 
 	// Implement this logic
-	freeVM(); 
+	freeVM(&vm); 
+	free((void*)paths);
 
-	return 0;
-}  
+	return exitCode;
+}
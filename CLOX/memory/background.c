@@ -0,0 +1,247 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "background.h"
+#include "memory.h"
+#include "../vm/vm.h"
+#include "../table/table.h"
+
+typedef struct {
+	// Gray objects any marker can take. Each worker traces from a stack of its own and only comes here
+	// when it runs dry, or to hand over half of its stack while another worker is waiting for work
+	mtx_t lock;
+	cnd_t changed;
+	Obj** objects;
+	int count;
+	int capacity;
+	int workerCount;
+	int idle;				// marking is over when every worker is idle with the pool empty
+	atomic_int waiting;		// read without the lock, so busy workers notice an idle one cheaply
+} MarkPool;
+
+typedef struct {
+	Obj** objects;
+	int count;
+	int capacity;
+} GrayStack;
+
+static void reserveObjects(Obj*** objects, int* capacity, int needed) {
+	// Plain realloc() - reallocate() updates the VM's counters, which only the collecting thread may touch
+	if (*capacity >= needed) return;
+
+	int newCapacity = *capacity;
+	while (newCapacity < needed) newCapacity = GROW_CAPACITY(newCapacity);
+	Obj** grown = (Obj**)realloc(*objects, sizeof(Obj*) * newCapacity);
+	if (grown == NULL) exit(1);
+	*objects = grown;
+	*capacity = newCapacity;
+}
+
+static void markChild(GrayStack* stack, Obj* object) {
+	// Two markers can reach the same piece - only the one that sets the flag traces it. Strings have
+	// no references, so they are done once marked
+	if (object == NULL || atomic_exchange_explicit(&object->isMarked, true, memory_order_relaxed)) return;
+	if (object->type != OBJ_ROPE) return;
+
+	reserveObjects(&stack->objects, &stack->capacity, stack->count + 1);
+	stack->objects[stack->count++] = object;
+}
+
+static void share(MarkPool* pool, GrayStack* stack) {
+	// The bottom half is nearest the roots, so it is the likeliest to hold big subgraphs
+	int shared = stack->count / 2;
+	mtx_lock(&pool->lock);
+	reserveObjects(&pool->objects, &pool->capacity, pool->count + shared);
+	memcpy(pool->objects + pool->count, stack->objects, sizeof(Obj*) * shared);
+	pool->count += shared;
+	cnd_broadcast(&pool->changed);
+	mtx_unlock(&pool->lock);
+
+	stack->count -= shared;
+	memmove(stack->objects, stack->objects + shared, sizeof(Obj*) * stack->count);
+}
+
+static void drain(MarkPool* pool, GrayStack* stack) {
+	while (stack->count > 0) {
+		Obj* object = stack->objects[--stack->count];
+		if (object->type == OBJ_ROPE) {
+			ObjRope* rope = (ObjRope*)object;
+			markChild(stack, rope->left);
+			markChild(stack, rope->right);
+			markChild(stack, (Obj*)rope->flat);
+		}
+
+		if (stack->count > 1 && atomic_load_explicit(&pool->waiting, memory_order_relaxed) > 0) share(pool, stack);
+	}
+}
+
+static int markWorker(void* arg) {
+	MarkPool* pool = (MarkPool*)arg;
+	GrayStack stack = { NULL, 0, 0 };
+
+	mtx_lock(&pool->lock);
+	for (;;) {
+		if (pool->count > 0) {
+			// Half of what is there, so the other workers aren't left with nothing
+			int taken = (pool->count + 1) / 2;
+			reserveObjects(&stack.objects, &stack.capacity, taken);
+			pool->count -= taken;
+			memcpy(stack.objects, pool->objects + pool->count, sizeof(Obj*) * taken);
+			stack.count = taken;
+			mtx_unlock(&pool->lock);
+
+			drain(pool, &stack);
+			mtx_lock(&pool->lock);
+			continue;
+		}
+
+		pool->idle++;
+		if (pool->idle == pool->workerCount) {
+			cnd_broadcast(&pool->changed);
+			break;
+		}
+		atomic_fetch_add(&pool->waiting, 1);
+		cnd_wait(&pool->changed, &pool->lock);
+		atomic_fetch_sub(&pool->waiting, 1);
+		if (pool->idle == pool->workerCount) break;
+		pool->idle--;
+	}
+	mtx_unlock(&pool->lock);
+
+	free(stack.objects);
+	return 0;
+}
+
+void markInParallel(VM* vm) {
+	// The roots are already marked and gray, so they are the pool to start from. Helpers are started
+	// for this collection only - a heap big enough to get here takes far longer to mark than that
+	MarkPool pool;
+	mtx_init(&pool.lock, mtx_plain);
+	cnd_init(&pool.changed);
+	pool.objects = NULL;
+	pool.capacity = 0;
+	reserveObjects(&pool.objects, &pool.capacity, vm->grayCount);
+	memcpy(pool.objects, vm->grayStack, sizeof(Obj*) * vm->grayCount);
+	pool.count = vm->grayCount;
+	vm->grayCount = 0;
+	pool.idle = 0;
+	atomic_init(&pool.waiting, 0);
+
+	// workerCount can only be too high while helpers start - none can see marking as finished early
+	int helpers = vm->markThreads < MARK_THREADS_MAX ? vm->markThreads : MARK_THREADS_MAX;
+	thrd_t threads[MARK_THREADS_MAX];
+	pool.workerCount = helpers + 1;
+	int started = 0;
+	for (int i = 0; i < helpers; i++) {
+		if (thrd_create(&threads[started], markWorker, &pool) == thrd_success) started++;
+	}
+	mtx_lock(&pool.lock);
+	pool.workerCount = started + 1;
+	mtx_unlock(&pool.lock);
+
+	markWorker(&pool);
+	for (int i = 0; i < started; i++) thrd_join(threads[i], NULL);
+
+	free(pool.objects);
+	cnd_destroy(&pool.changed);
+	mtx_destroy(&pool.lock);
+}
+
+typedef struct {
+	Table* table;
+	int start;
+	int end;
+} TableSlice;
+
+static int removeWhiteSlice(void* arg) {
+	TableSlice* slice = (TableSlice*)arg;
+	tableRemoveWhiteIn(slice->table, slice->start, slice->end);
+	return 0;
+}
+
+void removeWhiteInParallel(VM* vm) {
+	// Nearly every entry read is a cache miss on a string, so this scales much like marking does
+	Table* table = &vm->strings;
+	int helpers = vm->markThreads < MARK_THREADS_MAX ? vm->markThreads : MARK_THREADS_MAX;
+	int sliceCount = helpers + 1;
+	TableSlice slices[MARK_THREADS_MAX + 1];
+	for (int i = 0; i < sliceCount; i++) {
+		slices[i].table = table;
+		slices[i].start = (int)((long long)table->capacity * i / sliceCount);
+		slices[i].end = (int)((long long)table->capacity * (i + 1) / sliceCount);
+	}
+
+	thrd_t threads[MARK_THREADS_MAX];
+	bool started[MARK_THREADS_MAX];
+	for (int i = 0; i < helpers; i++) {
+		started[i] = thrd_create(&threads[i], removeWhiteSlice, &slices[i + 1]) == thrd_success;
+	}
+	removeWhiteSlice(&slices[0]);
+	for (int i = 0; i < helpers; i++) {
+		if (started[i]) thrd_join(threads[i], NULL);
+		else removeWhiteSlice(&slices[i + 1]);
+	}
+}
+
+static int sweepObjects(void* arg) {
+	// Runs next to the program, which only ever touches objects that are still reachable - and so
+	// marked and kept here - or ones allocated since, which are on a new vm->objects list
+	Sweep* sweep = (Sweep*)arg;
+	Obj* object = sweep->objects;
+	while (object != NULL) {
+		Obj* next = object->next;
+		if (atomic_load_explicit(&object->isMarked, memory_order_relaxed)) {
+			atomic_store_explicit(&object->isMarked, false, memory_order_relaxed);
+			if (sweep->survivorsTail != NULL) sweep->survivorsTail->next = object;
+			else sweep->survivors = object;
+			sweep->survivorsTail = object;
+		}
+		else {
+			sweep->freedBytes += objectSize(object);
+			free(object);
+		}
+		object = next;
+	}
+	if (sweep->survivorsTail != NULL) sweep->survivorsTail->next = NULL;
+
+	atomic_store(&sweep->done, true);
+	return 0;
+}
+
+void startSweep(VM* vm) {
+	Sweep* sweep = &vm->sweep;
+	sweep->objects = vm->objects;
+	sweep->survivors = NULL;
+	sweep->survivorsTail = NULL;
+	sweep->freedBytes = 0;
+	atomic_store(&sweep->done, false);
+	vm->objects = NULL;
+
+	// Below the threshold the sweep takes less than starting and joining a thread would
+	sweep->running = true;
+	sweep->threaded = vm->stats.bytesAllocated >= BACKGROUND_SWEEP_MIN &&
+		thrd_create(&sweep->thread, sweepObjects, sweep) == thrd_success;
+	if (!sweep->threaded) sweepObjects(sweep);
+}
+
+bool finishSweep(VM* vm, bool wait) {
+	Sweep* sweep = &vm->sweep;
+	if (!sweep->running) return true;
+	if (sweep->threaded) {
+		if (!wait && !atomic_load(&sweep->done)) return false;
+		thrd_join(sweep->thread, NULL);
+	}
+	sweep->running = false;
+
+	// Objects allocated meanwhile are on vm->objects already - the order of the list doesn't matter
+	if (sweep->survivors != NULL) {
+		sweep->survivorsTail->next = vm->objects;
+		vm->objects = sweep->survivors;
+	}
+
+	// The threshold set when marking finished counted the dead objects as well
+	vm->stats.bytesAllocated -= sweep->freedBytes;
+	vm->nextGC = vm->stats.bytesAllocated * GC_HEAP_GROW_FACTOR;
+	if (vm->nextGC < GC_HEAP_MIN) vm->nextGC = GC_HEAP_MIN;
+	return true;
+}
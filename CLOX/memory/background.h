@@ -0,0 +1,39 @@
+#ifndef clox_background_h
+#define clox_background_h
+
+#include <stdatomic.h>
+#include <threads.h>
+
+#include "../common.h"
+#include "../objects/objects.h"
+
+#define PARALLEL_MARK_MIN (8 * 1024 * 1024) // smaller heaps are marked by the collecting thread alone
+#define BACKGROUND_SWEEP_MIN (4 * 1024 * 1024) // smaller old spaces are swept inline - cheaper than starting a thread
+#define PARALLEL_TABLE_MIN (64 * 1024) // intern tables with fewer entries are cleared on the collecting thread
+#define MARK_THREADS_MAX 16
+
+typedef struct {
+	// The sweep of a full collection, done by a helper thread while the program carries on
+	thrd_t thread;
+	bool running;			// handed off and not taken back by finishSweep() yet
+	bool threaded;			// false when the sweep already ran inline - a small heap, or no thread could be started
+	atomic_bool done;
+	Obj* objects;			// the old space as marking left it - the sweeper owns these until it is done
+	Obj* survivors;			// what it kept, in order, spliced back onto vm->objects by finishSweep()
+	Obj* survivorsTail;
+	size_t freedBytes;		// only applied to vm->stats by finishSweep(), the sweeper never touches the VM
+} Sweep;
+
+// The collector's helper threads. Marking traces from the objects on vm->grayStack, which are already
+// marked, on the calling thread plus up to vm->markThreads helpers
+void markInParallel(VM* vm);
+// tableRemoveWhite() on the intern table, split into contiguous ranges across the same helpers
+void removeWhiteInParallel(VM* vm);
+// Takes the whole old space off vm->objects and frees its unmarked objects - on a background thread once
+// the heap is at least BACKGROUND_SWEEP_MIN
+void startSweep(VM* vm);
+// Joins the sweeper and takes back what it kept. Unless wait is set this does nothing until it has
+// finished - returns whether no sweep is outstanding any more
+bool finishSweep(VM* vm, bool wait);
+
+#endif
@@ -1,37 +1,273 @@
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "memory.h"
+#include "background.h"
 #include "../objects/objects.h"
 #include "../vm/vm.h"
+#include "../table/table.h"
+
+void* reallocate(VM* vm, void* pointer, size_t oldSize, size_t newSize) {
+	// Every heap block the VM owns goes through here, so this is where memory use is counted
+	vm->stats.bytesAllocated += newSize;
+	vm->stats.bytesAllocated -= oldSize;
+	if (vm->stats.bytesAllocated > vm->stats.peakBytesAllocated) {
+		vm->stats.peakBytesAllocated = vm->stats.bytesAllocated;
+	}
 
-void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
 	if (newSize == 0) {
 		free(pointer);
 		return NULL;
 	} 
 
+	vm->stats.allocations++;
 	void* result = realloc(pointer, newSize);
 	if (result == NULL) exit(1); // will be NULL when not enough memory in system to allocate
 	return result;
 }
 
-static void freeObj(Obj* object) { 
+size_t objectSize(Obj* object) {
 	switch (object->type) {
-		case OBJ_STRING: {
-			ObjString* string = (ObjString*)object;
-			FREE_ARRAY(char, string->chars, string->length + 1);
-			FREE(ObjString, object);
-			break;
+		case OBJ_STRING: return STRING_SIZE(((ObjString*)object)->length);
+		case OBJ_ROPE: return sizeof(ObjRope); // the pieces and the flattened string are objects of their own
+	}
+	return 0;
+}
+
+static void freeObj(VM* vm, Obj* object) { 
+	reallocate(vm, object, objectSize(object), 0);
+}
+
+bool isYoung(VM* vm, Obj* object) {
+	return (uint8_t*)object >= vm->nursery && (uint8_t*)object < vm->nurseryTop;
+}
+
+void* allocateObjectMemory(VM* vm, size_t size) {
+	// Objects made by a collecting run are bump allocated in the nursery - most are temporaries that are
+	// dead by the next safepoint and never cost a malloc or a free. Everything else goes to the old space
+	if (!vm->canCollect) return reallocate(vm, NULL, 0, size);
+	if (vm->debug.stressGC) vm->collectionDue = true;
+
+	if (size <= NURSERY_LARGE) {
+		if (vm->nursery == NULL) {
+			vm->nursery = ALLOCATE(vm, uint8_t, NURSERY_SIZE);
+			vm->nurseryTop = vm->nursery;
 		}
+
+		size_t aligned = NURSERY_ALIGN(size);
+		if (aligned <= (size_t)(vm->nursery + NURSERY_SIZE - vm->nurseryTop)) {
+			void* object = vm->nurseryTop;
+			vm->nurseryTop += aligned;
+			return object;
+		}
+		vm->collectionDue = true; // full until the next safepoint empties it
+	}
+
+	void* object = reallocate(vm, NULL, 0, size);
+	if (vm->stats.bytesAllocated > vm->nextGC) vm->collectionDue = true;
+	return object;
+}
+
+void freeObjectMemory(VM* vm, Obj* object, size_t size) {
+	// For an object nothing refers to yet. A young one is always the latest allocation in practice -
+	// if not it is just left as a dead object for the next minor collection to step over
+	if (!isYoung(vm, object)) {
+		reallocate(vm, object, size, 0);
+	}
+	else if ((uint8_t*)object + NURSERY_ALIGN(size) == vm->nurseryTop) {
+		vm->nurseryTop = (uint8_t*)object;
 	}
 }
 
-void freeObjects() {
-	Obj* object = vm.objects;
+void writeBarrier(VM* vm, Obj* object, Obj* value) {
+	// Minor collections don't trace the old space, so an old object that now points at a young one
+	// is remembered and its references are treated as roots
+	if (value == NULL || isYoung(vm, object) || !isYoung(vm, value)) return;
+
+	if (vm->rememberedCapacity < vm->rememberedCount + 1) {
+		int oldCapacity = vm->rememberedCapacity;
+		vm->rememberedCapacity = GROW_CAPACITY(oldCapacity);
+		vm->remembered = GROW_ARRAY(vm, Obj*, vm->remembered, oldCapacity, vm->rememberedCapacity);
+	}
+	vm->remembered[vm->rememberedCount++] = object;
+}
+
+void freeObjects(VM* vm) {
+	finishSweep(vm, true);
+
+	Obj* object = vm->objects;
 	while (object != NULL) {
 		Obj* next = object->next;
-		freeObj(object);
+		freeObj(vm, object);
 		object = next;
 	}
+	vm->objects = NULL;
+
+	// Young objects were never on the list - they go with the nursery
+	if (vm->nursery != NULL) FREE_ARRAY(vm, uint8_t, vm->nursery, NURSERY_SIZE);
+	vm->nursery = NULL;
+	vm->nurseryTop = NULL;
+
+	FREE_ARRAY(vm, Obj*, vm->grayStack, vm->grayCapacity);
+	vm->grayStack = NULL;
+	vm->grayCapacity = 0;
+	FREE_ARRAY(vm, Obj*, vm->remembered, vm->rememberedCapacity);
+	vm->remembered = NULL;
+	vm->rememberedCount = 0;
+	vm->rememberedCapacity = 0;
+}
+
+static void pushGray(VM* vm, Obj* object) {
+	if (vm->grayCapacity < vm->grayCount + 1) {
+		int oldCapacity = vm->grayCapacity;
+		vm->grayCapacity = GROW_CAPACITY(oldCapacity);
+		vm->grayStack = GROW_ARRAY(vm, Obj*, vm->grayStack, oldCapacity, vm->grayCapacity);
+	}
+	vm->grayStack[vm->grayCount++] = object;
+}
+
+static Obj* promote(VM* vm, Obj* object) {
+	// Returns where a young object lives from now on. The first visit copies it to the old space and
+	// leaves a forwarding pointer behind - a young object's isMarked means "moved", and next is the copy
+	if (object == NULL || !isYoung(vm, object)) return object;
+	if (object->isMarked) return object->next;
+
+	size_t size = objectSize(object);
+	Obj* copy = (Obj*)reallocate(vm, NULL, 0, size);
+	memcpy(copy, object, size);
+	copy->next = vm->objects;
+	vm->objects = copy;
+
+	object->isMarked = true;
+	object->next = copy;
+	if (copy->type == OBJ_ROPE) pushGray(vm, copy); // its pieces still point into the nursery
+	return copy;
 }
 
+static void promoteReferences(VM* vm, Obj* object) {
+	if (object->type != OBJ_ROPE) return;
+	ObjRope* rope = (ObjRope*)object;
+	rope->left = promote(vm, rope->left);
+	rope->right = promote(vm, rope->right);
+	rope->flat = (ObjString*)promote(vm, (Obj*)rope->flat);
+}
+
+static void promoteValues(VM* vm, Value* values, int count) {
+	for (int i = 0; i < count; i++) {
+		if (IS_OBJ(values[i])) values[i] = OBJ_VAL(promote(vm, AS_OBJ(values[i])));
+	}
+}
+
+static uint64_t nanoTime() {
+	struct timespec time;
+	timespec_get(&time, TIME_UTC);
+	return (uint64_t)time.tv_sec * 1000000000u + (uint64_t)time.tv_nsec;
+}
+
+static void reportPause(VM* vm, bool full, uint64_t start) {
+	uint64_t pause = nanoTime() - start;
+	vm->stats.gcPauseNanos += pause;
+	if (pause > vm->stats.maxGcPauseNanos) vm->stats.maxGcPauseNanos = pause;
+	if (vm->debug.collectionHook != NULL) vm->debug.collectionHook(vm, full, pause);
+}
+
+static void promoteSurvivors(VM* vm) {
+	// A minor collection. The roots are the stack, the result and the remembered old objects - inputs,
+	// constants and pinned values are always old. Survivors are copied out, and the nursery is empty after
+	promoteValues(vm, vm->stack, (int)(vm->stackTop - vm->stack));
+	promoteValues(vm, &vm->result, 1);
+	for (int i = 0; i < vm->rememberedCount; i++) promoteReferences(vm, vm->remembered[i]);
+	vm->rememberedCount = 0;
+	while (vm->grayCount > 0) promoteReferences(vm, vm->grayStack[--vm->grayCount]);
+
+	// The intern table is weak - moved strings take their entry with them, dead ones lose it
+	for (uint8_t* position = vm->nursery; position < vm->nurseryTop;) {
+		Obj* object = (Obj*)position;
+		if (object->type == OBJ_STRING) {
+			ObjString* string = (ObjString*)object;
+			if (object->isMarked) tableReplaceKey(&vm->strings, string, (ObjString*)object->next);
+			else tableDelete(&vm->strings, string);
+		}
+		position += NURSERY_ALIGN(objectSize(object));
+	}
+
+	vm->nurseryTop = vm->nursery;
+	vm->stats.minorCollections++;
+}
+
+void collectYoung(VM* vm) {
+	// Checked before starting the clock - every run ends here, and most leave the nursery empty
+	if (vm->nursery == NULL || vm->nurseryTop == vm->nursery) return;
+
+	uint64_t start = nanoTime();
+	promoteSurvivors(vm);
+	reportPause(vm, false, start);
+}
+
+
+static void markObject(VM* vm, Obj* object) {
+	if (object == NULL || atomic_load_explicit(&object->isMarked, memory_order_relaxed)) return;
+	atomic_store_explicit(&object->isMarked, true, memory_order_relaxed);
+
+	// Gray - marked but its references not traced yet. Ropes can be as deep as they are long,
+	// so tracing works off this stack instead of recursing
+	pushGray(vm, object);
+}
+
+static void markValues(VM* vm, const Value* values, int count) {
+	for (int i = 0; i < count; i++) {
+		if (IS_OBJ(values[i])) markObject(vm, AS_OBJ(values[i]));
+	}
+}
+
+static void markRoots(VM* vm) {
+	markValues(vm, vm->stack, (int)(vm->stackTop - vm->stack));
+	markValues(vm, &vm->result, 1);
+	markValues(vm, vm->pinned.values, vm->pinned.count);
+
+	// Collections only happen while a chunk runs, see collectAtSafepoint()
+	markValues(vm, vm->chunk->constants.values, vm->chunk->constants.count);
+	if (vm->inputs != NULL) markValues(vm, vm->inputs, vm->chunk->inputCount);
+}
+
+static void traceReferences(VM* vm) {
+	while (vm->grayCount > 0) {
+		Obj* object = vm->grayStack[--vm->grayCount];
+		if (object->type == OBJ_ROPE) {
+			ObjRope* rope = (ObjRope*)object;
+			markObject(vm, rope->left);
+			markObject(vm, rope->right);
+			markObject(vm, (Obj*)rope->flat);
+		}
+	}
+}
+
+void collectGarbage(VM* vm) {
+	// Only the old space is marked and swept, so the nursery is emptied first. The pause covers
+	// waiting for the previous sweep, marking and clearing the intern table - not the sweep itself
+	uint64_t start = nanoTime();
+	finishSweep(vm, true);
+	if (vm->nursery != NULL && vm->nurseryTop != vm->nursery) promoteSurvivors(vm);
+
+	markRoots(vm);
+	if (vm->markThreads > 0 && vm->stats.bytesAllocated >= PARALLEL_MARK_MIN) markInParallel(vm);
+	else traceReferences(vm);
+
+	// The intern table is weak - it must not keep strings alive, nor point at them once they are freed
+	if (vm->markThreads > 0 && vm->strings.capacity >= PARALLEL_TABLE_MIN) removeWhiteInParallel(vm);
+	else tableRemoveWhite(&vm->strings);
+	startSweep(vm);
+
+	// Provisional until finishSweep() knows how much was freed
+	vm->nextGC = vm->stats.bytesAllocated * GC_HEAP_GROW_FACTOR;
+	vm->stats.collections++;
+	reportPause(vm, true, start);
+}
+
+void collectAtSafepoint(VM* vm) {
+	finishSweep(vm, false);
+	collectYoung(vm);
+	if (vm->debug.stressGC || vm->stats.bytesAllocated > vm->nextGC) collectGarbage(vm);
+	vm->collectionDue = false;
+}
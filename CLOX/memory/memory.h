@@ -4,20 +4,46 @@
 #include "../common.h"
 #include "../objects/objects.h"
 
-#define ALLOCATE(type, count) \
-		(type*)reallocate(NULL, 0, sizeof(type)*(count))
+#define ALLOCATE(vm, type, count) \
+		(type*)reallocate(vm, NULL, 0, sizeof(type)*(count))
 
-#define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
+#define FREE(vm, type, pointer) reallocate(vm, pointer, sizeof(type), 0)
 
 #define GROW_CAPACITY(capacity) ((capacity) < 8 ? 8 : (capacity) * 2)
 
-#define GROW_ARRAY(type, pointer, oldCount, newCount) \
-		(type*)reallocate(pointer, sizeof(type) * (oldCount), sizeof(type) * (newCount))
+#define GROW_ARRAY(vm, type, pointer, oldCount, newCount) \
+		(type*)reallocate(vm, pointer, sizeof(type) * (oldCount), sizeof(type) * (newCount))
 
-#define FREE_ARRAY(type, pointer, oldCount) \
-		reallocate(pointer, sizeof(type) * (oldCount), 0)
+#define FREE_ARRAY(vm, type, pointer, oldCount) \
+		reallocate(vm, pointer, sizeof(type) * (oldCount), 0)
 
- void* reallocate(void* pointer, size_t oldsize, size_t newSize);
- void freeObjects();
+#define GC_HEAP_MIN (1024 * 1024) // first collection threshold, and the lowest nextGC ever gets
+#define GC_HEAP_GROW_FACTOR 2 // after a collection the next one waits until the heap has doubled
+
+#define NURSERY_SIZE (256 * 1024) // young objects are bump allocated from here while a chunk runs
+#define NURSERY_LARGE (NURSERY_SIZE / 8) // bigger objects go straight to the old space
+#define NURSERY_ALIGN(size) (((size) + 7) & ~(size_t)7)
+
+ void* reallocate(VM* vm, void* pointer, size_t oldsize, size_t newSize);
+ size_t objectSize(Obj* object);
+
+ // Objects are allocated through these instead of reallocate() - see the nursery in vm.h
+ void* allocateObjectMemory(VM* vm, size_t size);
+ void freeObjectMemory(VM* vm, Obj* object, size_t size);
+ bool isYoung(VM* vm, Obj* object);
+ // Must be called whenever a reference is stored into an object that already existed
+ void writeBarrier(VM* vm, Obj* object, Obj* value);
+
+ // Collections move young objects, so they only happen at safepoints, where every live value is on the
+ // stack or in vm->result - never while C code holds an object. That means only while a chunk runs:
+ // objects the host creates or gets back between runs stay valid until the next run.
+ // collectYoung() promotes the nursery's survivors. collectGarbage() then marks the old space from the
+ // stack, the running chunk's constants and inputs, the last result and the constants of every
+ // Program - on several threads for big heaps - and leaves the sweep to a background thread, see
+ // background.h. collectAtSafepoint() does whichever the allocator asked for
+ void collectYoung(VM* vm);
+ void collectGarbage(VM* vm);
+ void collectAtSafepoint(VM* vm);
+ void freeObjects(VM* vm);
 		
 #endif
@@ -4,39 +4,162 @@
 #include "../memory/memory.h"
 #include "objects.h"
 #include "../value/value.h"
+#include "../table/table.h"
 #include "../vm/vm.h"
 
-#define ALLOCATE_OBJ(type, objectType) \
-    (type*)allocateObject(sizeof(type), objectType)
+#define ALLOCATE_OBJ(vm, type, objectType) \
+    (type*)allocateObject(vm, sizeof(type), objectType)
 
-static Obj* allocateObject(size_t size, ObjType type) {
-	Obj* object = (Obj*)reallocate(NULL, 0, size);
+static void trackObject(VM* vm, Obj* object) {
+	// Old objects go on the list the full collector sweeps. Young ones are found by walking the nursery
+	atomic_store_explicit(&object->isMarked, false, memory_order_relaxed);
+	if (isYoung(vm, object)) return;
+	object->next = vm->objects;
+	vm->objects = object;
+}
+
+static Obj* allocateObject(VM* vm, size_t size, ObjType type) {
+	Obj* object = (Obj*)allocateObjectMemory(vm, size);
 	object->type = type;
-	object->next = NULL; 
-	vm.objects = object;
+	trackObject(vm, object);
 	return object;
 }
 
-static ObjString* allocateString(char* chars, int length) {
-	ObjString* string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
+static ObjString* allocateString(VM* vm, int length) {
+	// Header and characters come from one allocation. The string isn't tracked or interned
+	// until its characters have been filled in
+	ObjString* string = (ObjString*)allocateObjectMemory(vm, STRING_SIZE(length));
+	string->obj.type = OBJ_STRING;
+	atomic_store_explicit(&string->obj.isMarked, false, memory_order_relaxed);
 	string->length = length;
-	string->chars = chars;
+	string->chars[length] = '\0';
+	return string;
+}
+
+static ObjString* registerString(VM* vm, ObjString* string, uint32_t hash) {
+	string->hash = hash;
+	trackObject(vm, (Obj*)string);
+
+	// Every string is interned, so two strings with the same characters are always the same object
+	tableSet(vm, &vm->strings, string, NIL_VAL);
 	return string;
 }
 
-ObjString* takeString(char* chars, int length) {
-	return allocateString(chars, length);
+static uint32_t hashString(const char* key, int length) {
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (int i = 0; i < length; i++) {
+		hash ^= (uint8_t)key[i];
+		hash *= 16777619;
+	}
+	return hash;
+}
+
+static ObjString* internString(VM* vm, ObjString* string) {
+	// For strings built in place - dropped again if the characters are already interned
+	uint32_t hash = hashString(string->chars, string->length);
+	ObjString* interned = tableFindString(&vm->strings, string->chars, string->length, hash);
+	if (interned != NULL) {
+		string->hash = hash; // in case it stays in the nursery as a dead object
+		freeObjectMemory(vm, (Obj*)string, STRING_SIZE(string->length));
+		return interned;
+	}
+
+	return registerString(vm, string, hash);
+}
+
+ObjString* copyString(VM* vm, const char* chars, int length) {
+	// Looked up before allocating, so copying an existing string costs no allocation at all
+	uint32_t hash = hashString(chars, length);
+	ObjString* interned = tableFindString(&vm->strings, chars, length, hash);
+	if (interned != NULL) return interned;
+
+	ObjString* string = allocateString(vm, length);
+	memcpy(string->chars, chars, length);
+	return registerString(vm, string, hash);
+}
+
+static ObjString* concatenateStrings(VM* vm, ObjString* a, ObjString* b) {
+	ObjString* string = allocateString(vm, a->length + b->length);
+	memcpy(string->chars, a->chars, a->length);
+	memcpy(string->chars + a->length, b->chars, b->length);
+	return internString(vm, string);
 }
 
-ObjString* copyString(const char* chars, int length) {
-	char* heapChars = ALLOCATE(char, length + 1);
-	memcpy(heapChars, chars, length);
-	heapChars[length] = '\0';
-	return allocateString(heapChars, length);
+int stringLength(Obj* object) {
+	return object->type == OBJ_ROPE ? ((ObjRope*)object)->length : ((ObjString*)object)->length;
 }
 
-void printObject(Value value) {
+Obj* concatenate(VM* vm, Obj* a, Obj* b) {
+	// a and b are strings or ropes. Building a string from N pieces with eager copies moves O(N^2) bytes,
+	// so longer results become a rope node and are copied once when flattened
+	int length = stringLength(a) + stringLength(b);
+	if (length < ROPE_MIN_LENGTH) {
+		// Ropes are never shorter than ROPE_MIN_LENGTH, so both sides are plain strings here
+		return (Obj*)concatenateStrings(vm, (ObjString*)a, (ObjString*)b);
+	}
+
+	ObjRope* rope = ALLOCATE_OBJ(vm, ObjRope, OBJ_ROPE);
+	rope->length = length;
+	rope->left = a;
+	rope->right = b;
+	rope->flat = NULL;
+	// Only a rope that didn't fit in the nursery can be old and point at young pieces
+	writeBarrier(vm, (Obj*)rope, a);
+	writeBarrier(vm, (Obj*)rope, b);
+	return (Obj*)rope;
+}
+
+ObjString* flattenString(VM* vm, Obj* object) {
+	if (object->type == OBJ_STRING) return (ObjString*)object;
+
+	ObjRope* rope = (ObjRope*)object;
+	if (rope->flat != NULL) return rope->flat;
+
+	ObjString* string = allocateString(vm, rope->length);
+	int position = 0;
+
+	// In-order walk with an explicit stack - ropes built in a loop are as deep as they are long,
+	// which would overflow the C stack if this recursed
+	int stackCapacity = 0;
+	int stackCount = 0;
+	Obj** stack = NULL;
+
+	Obj* node = object;
+	for (;;) {
+		if (node->type == OBJ_ROPE && ((ObjRope*)node)->flat == NULL) {
+			// Come back for the right side after the left one has been copied
+			if (stackCapacity < stackCount + 1) {
+				int oldCapacity = stackCapacity;
+				stackCapacity = GROW_CAPACITY(oldCapacity);
+				stack = GROW_ARRAY(vm, Obj*, stack, oldCapacity, stackCapacity);
+			}
+			stack[stackCount++] = ((ObjRope*)node)->right;
+			node = ((ObjRope*)node)->left;
+			continue;
+		}
+
+		ObjString* piece = node->type == OBJ_ROPE ? ((ObjRope*)node)->flat : (ObjString*)node;
+		memcpy(string->chars + position, piece->chars, piece->length);
+		position += piece->length;
+
+		if (stackCount == 0) break;
+		node = stack[--stackCount];
+	}
+
+	FREE_ARRAY(vm, Obj*, stack, stackCapacity);
+
+	// Cache the interned result and let go of the pieces
+	rope->flat = internString(vm, string);
+	rope->left = NULL;
+	rope->right = NULL;
+	writeBarrier(vm, (Obj*)rope, (Obj*)rope->flat);
+	return rope->flat;
+}
+
+void printObject(VM* vm, Value value) {
 	switch (OBJ_TYPE(value)) {
-		case OBJ_STRING: printf("%s", AS_CSTRING(value)); break;
+		case OBJ_STRING: fprintf(vm->output, "%s", AS_CSTRING(value)); break;
+		case OBJ_ROPE: fprintf(vm->output, "%s", flattenString(vm, AS_OBJ(value))->chars); break;
 	}
-}
\ No newline at end of file
+}
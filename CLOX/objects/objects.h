@@ -1,34 +1,59 @@
 #ifndef clox_object_h
 #define clox_object_h 
 
+#include <stdatomic.h>
+
 #include "../common.h"
 #include "../value/value.h"
 
 #define OBJ_TYPE(value)		(AS_OBJ(value)->type)
 
 #define IS_STRING(value)	isObjType(value, OBJ_STRING)
+#define IS_ROPE(value)		isObjType(value, OBJ_ROPE)
+#define IS_STRING_OR_ROPE(value)	(IS_STRING(value) || IS_ROPE(value))
 
 #define AS_STRING(value)	((ObjString*)AS_OBJ(value))
 #define AS_CSTRING(value)	(((ObjString*)AS_OBJ(value))->chars)
+#define AS_ROPE(value)		((ObjRope*)AS_OBJ(value))
+
+// Concatenations shorter than this are copied right away - below it a rope node costs more than the copy
+#define ROPE_MIN_LENGTH 32
 
 typedef enum {
 	OBJ_STRING,
+	OBJ_ROPE,
 } ObjType;
 
 struct Obj {
 	ObjType type;
+	atomic_bool isMarked; // reached by the collector. Atomic since marking and sweeping can run on other threads
 	struct Obj* next;
 };
 
 struct ObjString {
 	Obj obj;
 	int length;
-	char* chars;
+	uint32_t hash; // cached so the intern table never rehashes a string
+	char chars[]; // stored inline, NUL terminated - the whole string is a single allocation
 }; 
 
-ObjString* takeString(char* chars, int length);
-ObjString* copyString(const char* chars, int length);
-void printObject(Value value);
+// Bytes taken by a string of the given length, header included
+#define STRING_SIZE(length) (sizeof(ObjString) + (length) + 1)
+
+typedef struct {
+	// A lazy concatenation - the bytes are only copied (once) when something needs them
+	Obj obj;
+	int length;
+	Obj* left;			// ObjString or ObjRope, NULL once flattened
+	Obj* right;
+	ObjString* flat;	// the interned result, NULL until flattened
+} ObjRope;
+
+ObjString* copyString(VM* vm, const char* chars, int length);
+Obj* concatenate(VM* vm, Obj* a, Obj* b);
+ObjString* flattenString(VM* vm, Obj* object);
+int stringLength(Obj* object);
+void printObject(VM* vm, Value value);
 
 static inline bool isObjType(Value value, ObjType type) {
 	return IS_OBJ(value) && AS_OBJ(value)->type == type;
@@ -1,15 +1,15 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <threads.h>
 
 #include "../common.h"
 #include "scanner.h"
 
-Scanner scanner; 
-
-void initScanner(const char* source) {
-	scanner.start = source;
-	scanner.current = source;
-	scanner.line = 1;
+void initScanner(Scanner* scanner, const char* source) {
+	scanner->start = source;
+	scanner->current = source;
+	scanner->line = 1;
 } 
 
 static bool isAlpha(char c) {
@@ -22,186 +22,484 @@ static bool isDigit(char c) {
 	return c >= '0' && c <= '9';
 }
 
-static bool isAtEnd() {
-	return *scanner.current == '\0';
+// Runs of whitespace, identifier characters, digits, string bodies and comments are skipped a whole
+// block at a time. Each block is classified into a bitmask (bit i set when byte i belongs to the run),
+// and the first clear bit is where the run ends. The NUL terminator never belongs to a run, so the
+// end of the source needs no separate check. Loads are aligned, so a block never crosses into the next
+// page - that makes reading the few bytes past the terminator (or before the start) harmless. AddressSanitizer
+// can't know that, so the functions doing those loads opt out of its checks.
+// Build with -mavx2 for 32 byte blocks, or define NO_SIMD_SCANNER for the plain loops
+#if defined(NO_SIMD_SCANNER)
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define SCAN_BLOCK 32
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SCAN_BLOCK 16
+#endif
+
+#if defined(SCAN_BLOCK) && defined(_MSC_VER)
+#include <intrin.h>
+#define NO_SANITIZE_ADDRESS __declspec(no_sanitize_address)
+#elif defined(SCAN_BLOCK)
+#define NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#endif
+
+#define SCAN_SHORT_RUN 4
+
+#define LEX_SEGMENT_MIN (256 * 1024)	// smaller sources aren't worth starting a thread for
+#define LEX_THREADS_MAX 64
+#define BYTES_PER_TOKEN_ESTIMATE 4
+
+typedef enum {
+	SCAN_WHITESPACE,	// ' ' '\r' '\t' '\n'
+	SCAN_IDENTIFIER,	// letters, digits and '_'
+	SCAN_DIGIT,
+	SCAN_STRING_BODY,	// anything but '"'
+	SCAN_COMMENT,		// anything but '\n'
+} ScanClass;
+
+static inline bool inRun(char c, ScanClass scanClass) {
+	switch (scanClass) {
+		case SCAN_WHITESPACE:	return c == ' ' || c == '\r' || c == '\t' || c == '\n';
+		case SCAN_IDENTIFIER:	return isAlpha(c) || isDigit(c);
+		case SCAN_DIGIT:		return isDigit(c);
+		case SCAN_STRING_BODY:	return c != '"' && c != '\0';
+		case SCAN_COMMENT:		return c != '\n' && c != '\0';
+	}
+	return false;
+}
+
+#ifdef SCAN_BLOCK
+
+#if SCAN_BLOCK == 32
+typedef __m256i ScanVector;
+#define VECTOR_LOAD(pointer)		_mm256_load_si256((const __m256i*)(pointer))
+#define VECTOR_SPLAT(c)				_mm256_set1_epi8(c)
+#define VECTOR_EQUAL(a, b)			_mm256_cmpeq_epi8(a, b)
+#define VECTOR_OR(a, b)				_mm256_or_si256(a, b)
+#define VECTOR_SUBTRACT(a, b)		_mm256_sub_epi8(a, b)
+#define VECTOR_MIN(a, b)			_mm256_min_epu8(a, b)
+#define VECTOR_MASK(vector)			((uint32_t)_mm256_movemask_epi8(vector))
+#define BLOCK_BITS					0xffffffffu
+#else
+typedef __m128i ScanVector;
+#define VECTOR_LOAD(pointer)		_mm_load_si128((const __m128i*)(pointer))
+#define VECTOR_SPLAT(c)				_mm_set1_epi8(c)
+#define VECTOR_EQUAL(a, b)			_mm_cmpeq_epi8(a, b)
+#define VECTOR_OR(a, b)				_mm_or_si128(a, b)
+#define VECTOR_SUBTRACT(a, b)		_mm_sub_epi8(a, b)
+#define VECTOR_MIN(a, b)			_mm_min_epu8(a, b)
+#define VECTOR_MASK(vector)			((uint32_t)_mm_movemask_epi8(vector))
+#define BLOCK_BITS					0xffffu
+#endif
+
+// lo <= c <= hi as one unsigned compare: (c - lo) <= (hi - lo), done with min since there is no unsigned cmpgt
+#define VECTOR_IN_RANGE(vector, lo, hi) \
+		VECTOR_EQUAL(VECTOR_MIN(VECTOR_SUBTRACT(vector, VECTOR_SPLAT(lo)), VECTOR_SPLAT((hi) - (lo))), \
+			VECTOR_SUBTRACT(vector, VECTOR_SPLAT(lo)))
+
+static inline int countTrailingZeros(uint32_t bits) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, bits);
+	return (int)index;
+#else
+	return __builtin_ctz(bits);
+#endif
+}
+
+static inline int countBits(uint32_t bits) {
+#ifdef _MSC_VER
+	// __popcnt needs a CPU with POPCNT, which SSE2 alone doesn't promise
+	bits = bits - ((bits >> 1) & 0x55555555u);
+	bits = (bits & 0x33333333u) + ((bits >> 2) & 0x33333333u);
+	return (int)((((bits + (bits >> 4)) & 0x0f0f0f0fu) * 0x01010101u) >> 24);
+#else
+	return __builtin_popcount(bits);
+#endif
+}
+
+NO_SANITIZE_ADDRESS static inline uint32_t classifyBlock(const char* block, ScanClass scanClass, uint32_t* newlines) {
+	ScanVector bytes = VECTOR_LOAD(block);
+	ScanVector newline = VECTOR_EQUAL(bytes, VECTOR_SPLAT('\n'));
+	*newlines = VECTOR_MASK(newline);
+
+	switch (scanClass) {
+		case SCAN_WHITESPACE:
+			return VECTOR_MASK(VECTOR_OR(VECTOR_OR(newline, VECTOR_EQUAL(bytes, VECTOR_SPLAT(' '))),
+				VECTOR_OR(VECTOR_EQUAL(bytes, VECTOR_SPLAT('\r')), VECTOR_EQUAL(bytes, VECTOR_SPLAT('\t')))));
+		case SCAN_IDENTIFIER: {
+			// OR-ing in 0x20 folds upper case onto lower case
+			ScanVector folded = VECTOR_OR(bytes, VECTOR_SPLAT(0x20));
+			return VECTOR_MASK(VECTOR_OR(VECTOR_OR(VECTOR_IN_RANGE(folded, 'a', 'z'), VECTOR_IN_RANGE(bytes, '0', '9')),
+				VECTOR_EQUAL(bytes, VECTOR_SPLAT('_'))));
+		}
+		case SCAN_DIGIT:
+			return VECTOR_MASK(VECTOR_IN_RANGE(bytes, '0', '9'));
+		case SCAN_STRING_BODY:
+			return ~VECTOR_MASK(VECTOR_OR(VECTOR_EQUAL(bytes, VECTOR_SPLAT('"')), VECTOR_EQUAL(bytes, VECTOR_SPLAT(0))));
+		case SCAN_COMMENT:
+			return ~VECTOR_MASK(VECTOR_OR(newline, VECTOR_EQUAL(bytes, VECTOR_SPLAT(0))));
+	}
+	return 0;
+}
+
+NO_SANITIZE_ADDRESS static const char* skipLongRun(const char* current, ScanClass scanClass, int* line) {
+	const char* block = (const char*)((uintptr_t)current & ~(uintptr_t)(SCAN_BLOCK - 1));
+	uint32_t from = BLOCK_BITS & (BLOCK_BITS << (current - block)); // bytes before current aren't ours
+
+	for (;;) {
+		uint32_t newlines;
+		uint32_t stops = ~classifyBlock(block, scanClass, &newlines) & from;
+
+		if (stops != 0) {
+			uint32_t skipped = from & ((1u << countTrailingZeros(stops)) - 1);
+			*line += countBits(newlines & skipped);
+			return block + countTrailingZeros(stops);
+		}
+
+		*line += countBits(newlines & from);
+		block += SCAN_BLOCK;
+		from = BLOCK_BITS;
+	}
+}
+
+static inline const char* skipRun(const char* current, ScanClass scanClass, int* line) {
+	// Returns the first character after the run starting at current, adding the newlines it skipped to *line.
+	// Most runs are only a character or two long (a single space, a short number), and those are
+	// cheaper to finish one byte at a time than to set up a block for
+	for (int i = 0; i < SCAN_SHORT_RUN; i++) {
+		if (!inRun(*current, scanClass)) return current;
+		if (*current == '\n') (*line)++;
+		current++;
+	}
+	return skipLongRun(current, scanClass, line);
+}
+
+#else
+
+static inline const char* skipRun(const char* current, ScanClass scanClass, int* line) {
+	// Scalar fallback for targets without SSE2
+	while (inRun(*current, scanClass)) {
+		if (*current == '\n') (*line)++;
+		current++;
+	}
+	return current;
+}
+
+#endif
+
+static bool isAtEnd(Scanner* scanner) {
+	return *scanner->current == '\0';
 } 
 
-static char advance() {
-	scanner.current++;
-	return scanner.current[-1]; 
+static char advance(Scanner* scanner) {
+	scanner->current++;
+	return scanner->current[-1]; 
 } 
 
-static char peek() {
-	return *scanner.current;
+static char peek(Scanner* scanner) {
+	return *scanner->current;
 } 
 
-static char peekNext() {
-	if (isAtEnd()) return '\0';
-	return scanner.current[1];
+static char peekNext(Scanner* scanner) {
+	if (isAtEnd(scanner)) return '\0';
+	return scanner->current[1];
 }
 
-static bool match(char expected) {
-	if (isAtEnd()) return false;
-	if (*scanner.current != expected) return false;
-	scanner.current++;
+static bool match(Scanner* scanner, char expected) {
+	if (isAtEnd(scanner)) return false;
+	if (*scanner->current != expected) return false;
+	scanner->current++;
 	return true;
 }
 
-static Token makeToken(TokenType type) {
+static Token makeToken(Scanner* scanner, TokenType type) {
 	Token token;
 	token.type = type; 
-	token.start = scanner.start;
-	token.length = (int)(scanner.current - scanner.start);
-	token.line = scanner.line;
+	token.start = scanner->start;
+	token.length = (int)(scanner->current - scanner->start);
+	token.line = scanner->line;
 	return token;
 } 
 
-static Token errorToken(const char* message) {
+static Token errorToken(Scanner* scanner, const char* message) {
 	Token token;
 	token.type = TOKEN_ERROR;
 	token.start = message; // message is a char array, so gives address
 	token.length = (int)strlen(message);
-	token.line = scanner.line;
+	token.line = scanner->line;
 	return token;
 }
 
-static void skipWhiteSpace() {
+static void skipWhiteSpace(Scanner* scanner) {
 	for (;;) {
-		char c = peek();
-		switch (c) {
-			case ' ': 
-			case '\r':
-			case '\t':
-				advance();
-				break; 
-			case '\n':
-				scanner.line++;
-				advance();
-				break;
-			case '/':
-				if (peekNext() == '/') {
-					// comment goes until the end of the line
-					while (peek() != '\n' && !isAtEnd()) advance();
-				}
-				else {
-					return;
-				}
-			default:
-				return;
-		}
+		scanner->current = skipRun(scanner->current, SCAN_WHITESPACE, &scanner->line);
+
+		if (peek(scanner) != '/' || peekNext(scanner) != '/') return;
+
+		// comment goes until the end of the line - the newline itself is left for the next whitespace run
+		scanner->current = skipRun(scanner->current + 2, SCAN_COMMENT, &scanner->line);
 	}
 }
 
-static TokenType checkKeyword(int start, int length, const char* rest, TokenType type) {
-	if (scanner.current - scanner.start == start + length &&
-		memcmp(scanner.start + start, rest, length) == 0) {
+static TokenType checkKeyword(Scanner* scanner, int start, int length, const char* rest, TokenType type) {
+	if (scanner->current - scanner->start == start + length &&
+		memcmp(scanner->start + start, rest, length) == 0) {
 		return type;
 	} 
 
 	return TOKEN_IDENTIFIER;
 }
 
-static TokenType identifierType() {
+static TokenType identifierType(Scanner* scanner) {
 
-	switch (scanner.start[0]) {
-		case 'a': return checkKeyword(1, 2, "nd", TOKEN_AND);
-		case 'c': return checkKeyword(1, 4, "lass", TOKEN_CLASS);
-		case 'e': return checkKeyword(1, 3, "lse", TOKEN_ELSE);
+	switch (scanner->start[0]) {
+		case 'a': return checkKeyword(scanner, 1, 2, "nd", TOKEN_AND);
+		case 'c': return checkKeyword(scanner, 1, 4, "lass", TOKEN_CLASS);
+		case 'e': return checkKeyword(scanner, 1, 3, "lse", TOKEN_ELSE);
 		case 'f':
-			if (scanner.current - scanner.start > 1) {
-				switch (scanner.start[1]) {
-					case 'a': return checkKeyword(2, 3, "lse", TOKEN_FALSE);
-					case 'o': return checkKeyword(2, 1, "r", TOKEN_FOR);
-					case 'u': return checkKeyword(2, 1, "n", TOKEN_FUN);
+			if (scanner->current - scanner->start > 1) {
+				switch (scanner->start[1]) {
+					case 'a': return checkKeyword(scanner, 2, 3, "lse", TOKEN_FALSE);
+					case 'o': return checkKeyword(scanner, 2, 1, "r", TOKEN_FOR);
+					case 'u': return checkKeyword(scanner, 2, 1, "n", TOKEN_FUN);
 				}
 			}
 			break;
-		case 'i': return checkKeyword(1, 1, "f", TOKEN_IF);
-		case 'n': return checkKeyword(1, 2, "il", TOKEN_NIL);
-		case 'o': return checkKeyword(1, 1, "r", TOKEN_OR);
-		case 'p': return checkKeyword(1, 4, "rint", TOKEN_PRINT);
-		case 'r': return checkKeyword(1, 5, "eturn", TOKEN_RETURN);
-		case 's': return checkKeyword(1, 4, "uper", TOKEN_SUPER);
+		case 'i': return checkKeyword(scanner, 1, 1, "f", TOKEN_IF);
+		case 'n': return checkKeyword(scanner, 1, 2, "il", TOKEN_NIL);
+		case 'o': return checkKeyword(scanner, 1, 1, "r", TOKEN_OR);
+		case 'p': return checkKeyword(scanner, 1, 4, "rint", TOKEN_PRINT);
+		case 'r': return checkKeyword(scanner, 1, 5, "eturn", TOKEN_RETURN);
+		case 's': return checkKeyword(scanner, 1, 4, "uper", TOKEN_SUPER);
 		case 't':
-			if (scanner.current - scanner.start > 1) {
-				switch (scanner.start[1]) {
-					case 'h': return checkKeyword(2, 2, "is", TOKEN_THIS);
-					case 'r': return checkKeyword(2, 2, "ue", TOKEN_TRUE);
+			if (scanner->current - scanner->start > 1) {
+				switch (scanner->start[1]) {
+					case 'h': return checkKeyword(scanner, 2, 2, "is", TOKEN_THIS);
+					case 'r': return checkKeyword(scanner, 2, 2, "ue", TOKEN_TRUE);
 				}
 			}
 			break;
-		case 'v': return checkKeyword(1, 2, "ar", TOKEN_VAR);
-		case 'w': return checkKeyword(1, 4, "hile", TOKEN_WHILE);
+		case 'v': return checkKeyword(scanner, 1, 2, "ar", TOKEN_VAR);
+		case 'w': return checkKeyword(scanner, 1, 4, "hile", TOKEN_WHILE);
 	}
 
 	return TOKEN_IDENTIFIER;
 }
 
-static Token identifier() {
+static Token identifier(Scanner* scanner) {
 	// After the first letter, we allow digits too
-	while (isAlpha(peek()) || isDigit(peek())) advance();
-	return makeToken(identifierType());
+	scanner->current = skipRun(scanner->current, SCAN_IDENTIFIER, &scanner->line);
+	return makeToken(scanner, identifierType(scanner));
 }
 
-static Token number() {
-	while (isDigit(peek())) advance();
+static Token number(Scanner* scanner) {
+	scanner->current = skipRun(scanner->current, SCAN_DIGIT, &scanner->line);
 
 	// Check for the fractional part
-	if (peek() == '.' && isDigit(peekNext())) {
+	if (peek(scanner) == '.' && isDigit(peekNext(scanner))) {
 		// Consume the '.'
-		advance(); 
+		advance(scanner); 
 
 		// Consume the remaining numbers after the decimal
-		while (isDigit(peek())) advance();
+		scanner->current = skipRun(scanner->current, SCAN_DIGIT, &scanner->line);
 	} 
 
-	return makeToken(TOKEN_NUMBER);
+	return makeToken(scanner, TOKEN_NUMBER);
 }
 
-static Token string() {
-	while (peek() != '"' && !isAtEnd()) {
-		if (peek() == '\n') scanner.line++;
-		advance();
-	} 
+static Token string(Scanner* scanner) {
+	scanner->current = skipRun(scanner->current, SCAN_STRING_BODY, &scanner->line);
 
-	if (isAtEnd()) return errorToken("Unterminated string.");
+	if (isAtEnd(scanner)) return errorToken(scanner, "Unterminated string.");
 
 	// Gets closing quote
-	advance();
-	return makeToken(TOKEN_STRING);
+	advance(scanner);
+	return makeToken(scanner, TOKEN_STRING);
 }
 
-Token scanToken() {
-	skipWhiteSpace();
+Token scanToken(Scanner* scanner) {
+	skipWhiteSpace(scanner);
 
-	scanner.start = scanner.current; 
+	scanner->start = scanner->current; 
 
-	if (isAtEnd()) return makeToken(TOKEN_EOF);
+	if (isAtEnd(scanner)) return makeToken(scanner, TOKEN_EOF);
 
-	char c = advance();
-	if (isAlpha(c)) return identifier();
-	if (isDigit(c)) return number();
+	char c = advance(scanner);
+	if (isAlpha(c)) return identifier(scanner);
+	if (isDigit(c)) return number(scanner);
 
 	switch (c) {
-		case '(': return makeToken(TOKEN_LEFT_PAREN);
-		case ')': return makeToken(TOKEN_RIGHT_PAREN);
-		case '{': return makeToken(TOKEN_LEFT_BRACE);
-		case '}': return makeToken(TOKEN_RIGHT_BRACE);
-		case ';': return makeToken(TOKEN_SEMICOLON);
-		case ',': return makeToken(TOKEN_COMMA);
-		case '.': return makeToken(TOKEN_DOT);
-		case '-': return makeToken(TOKEN_MINUS);
-		case '+': return makeToken(TOKEN_PLUS);
-		case '/': return makeToken(TOKEN_SLASH);
-		case '*': return makeToken(TOKEN_STAR);
-		case '!': return makeToken(match('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
-		case '=': return makeToken(match('=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
-		case '<': return makeToken(match('=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
-		case '>': return makeToken(match('=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
-		case '"': return string();
+		case '(': return makeToken(scanner, TOKEN_LEFT_PAREN);
+		case ')': return makeToken(scanner, TOKEN_RIGHT_PAREN);
+		case '{': return makeToken(scanner, TOKEN_LEFT_BRACE);
+		case '}': return makeToken(scanner, TOKEN_RIGHT_BRACE);
+		case ';': return makeToken(scanner, TOKEN_SEMICOLON);
+		case ',': return makeToken(scanner, TOKEN_COMMA);
+		case '.': return makeToken(scanner, TOKEN_DOT);
+		case '-': return makeToken(scanner, TOKEN_MINUS);
+		case '+': return makeToken(scanner, TOKEN_PLUS);
+		case '/': return makeToken(scanner, TOKEN_SLASH);
+		case '*': return makeToken(scanner, TOKEN_STAR);
+		case '!': return makeToken(scanner, match(scanner, '=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
+		case '=': return makeToken(scanner, match(scanner, '=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
+		case '<': return makeToken(scanner, match(scanner, '=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
+		case '>': return makeToken(scanner, match(scanner, '=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
+		case '"': return string(scanner);
 	}
 
-	return errorToken("Unexpected character.");
+	return errorToken(scanner, "Unexpected character.");
 
 }
 
+// Batch scanning. The token arrays are grown with plain realloc rather than reallocate(), since the
+// worker threads below must not touch the VM's allocation counters
+
+void initTokenArray(TokenArray* array) {
+	array->tokens = NULL;
+	array->count = 0;
+	array->capacity = 0;
+}
+
+void freeTokenArray(TokenArray* array) {
+	free(array->tokens);
+	initTokenArray(array);
+}
+
+static void reserveTokens(TokenArray* array, int capacity) {
+	Token* grown = (Token*)realloc(array->tokens, sizeof(Token) * capacity);
+	if (grown == NULL) {
+		fprintf(stderr, "Not enough memory to scan the source.\n");
+		exit(74);
+	}
+	array->tokens = grown;
+	array->capacity = capacity;
+}
+
+static void appendToken(TokenArray* array, Token token) {
+	if (array->capacity < array->count + 1) {
+		reserveTokens(array, array->capacity < 64 ? 64 : array->capacity * 2);
+	}
+	array->tokens[array->count++] = token;
+}
+
+typedef struct {
+	// One stretch of the source, lexed on its own thread
+	const char* start;
+	const char* end;	// always just after a newline outside any string or comment, or the terminator
+	int line;			// line number at start
+	TokenArray tokens;
+} LexSegment;
+
+static int lexSegment(void* argument) {
+	LexSegment* segment = (LexSegment*)argument;
+	Scanner scanner;
+	initScanner(&scanner, segment->start);
+	scanner.line = segment->line;
+
+	// Typical source averages a few bytes per token, so this usually avoids regrowing at all
+	reserveTokens(&segment->tokens, (int)((segment->end - segment->start) / BYTES_PER_TOKEN_ESTIMATE) + 1);
+
+	for (;;) {
+		Token token = scanToken(&scanner);
+
+		// No token crosses a segment boundary, so the first one starting past the end belongs to the next
+		// segment. Only the last segment reaches the terminator and keeps its TOKEN_EOF
+		if (*segment->end != '\0' && scanner.start >= segment->end) break;
+		appendToken(&segment->tokens, token);
+		if (token.type == TOKEN_EOF) break;
+	}
+	return 0;
+}
+
+static const char* findSplit(const char* from, const char* target, int* line) {
+	// Walks forward from 'from' (which is outside any string or comment) tracking just enough state to
+	// know when we are inside a string or comment, and returns the position after the first newline at
+	// or beyond target that is outside both. *line is advanced by the newlines passed
+	const char* current = from;
+	for (;;) {
+		current += strcspn(current, "\"/\n");
+		switch (*current) {
+			case '\0':
+				return current;
+			case '\n':
+				(*line)++;
+				current++;
+				if (current > target) return current;
+				break;
+			case '"':
+				current = skipRun(current + 1, SCAN_STRING_BODY, line);
+				if (*current == '"') current++;
+				break;
+			case '/':
+				current++;
+				if (*current == '/') current = skipRun(current + 1, SCAN_COMMENT, line);
+				break;
+		}
+	}
+}
+
+void scanTokens(const char* source, TokenArray* array, int threadCount) {
+	// Fills array with every token of source. Sources large enough to be worth it are cut into up to
+	// threadCount segments at safe newlines and lexed in parallel - the result is the same either way
+	initTokenArray(array);
+	size_t length = strlen(source);
+
+	int segmentCount = threadCount;
+	if ((size_t)segmentCount > length / LEX_SEGMENT_MIN) segmentCount = (int)(length / LEX_SEGMENT_MIN);
+	if (segmentCount > LEX_THREADS_MAX) segmentCount = LEX_THREADS_MAX;
+
+	if (segmentCount <= 1) {
+		LexSegment whole = { .start = source, .end = source + length, .line = 1 };
+		initTokenArray(&whole.tokens);
+		lexSegment(&whole);
+		*array = whole.tokens;
+		return;
+	}
+
+	// Finding the split points is one quick sequential pass that only looks at quotes, slashes and newlines
+	LexSegment segments[LEX_THREADS_MAX];
+	const char* start = source;
+	int line = 1;
+	int used = 0;
+	for (int i = 0; i < segmentCount && *start != '\0'; i++) {
+		LexSegment* segment = &segments[used++];
+		segment->start = start;
+		segment->line = line;
+		initTokenArray(&segment->tokens);
+
+		const char* target = source + length * (i + 1) / segmentCount;
+		segment->end = i == segmentCount - 1 ? source + length : findSplit(start, target, &line);
+		start = segment->end;
+	}
+
+	// The calling thread takes the first segment itself. A thread that can't be started is made up for
+	// by lexing its segment here after the others are joined
+	thrd_t threads[LEX_THREADS_MAX];
+	bool started[LEX_THREADS_MAX] = { false };
+	for (int i = 1; i < used; i++) {
+		started[i] = thrd_create(&threads[i], lexSegment, &segments[i]) == thrd_success;
+	}
+	lexSegment(&segments[0]);
+
+	int total = 0;
+	for (int i = 0; i < used; i++) {
+		if (i > 0) {
+			if (started[i]) thrd_join(threads[i], NULL);
+			else lexSegment(&segments[i]);
+		}
+		total += segments[i].tokens.count;
+	}
+
+	// Stitch the segments together onto the end of the first one - their line numbers are already right,
+	// since each started from the line count findSplit() passed over
+	*array = segments[0].tokens;
+	reserveTokens(array, total);
+	for (int i = 1; i < used; i++) {
+		memcpy(array->tokens + array->count, segments[i].tokens.tokens, sizeof(Token) * segments[i].tokens.count);
+		array->count += segments[i].tokens.count;
+		freeTokenArray(&segments[i].tokens);
+	}
+}
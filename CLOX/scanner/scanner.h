@@ -1,6 +1,8 @@
 #ifndef clox_scanner_h
 #define clox_scanner_h
 
+#include "../common.h"
+
 typedef enum {
 	// Single-character tokens.
 	TOKEN_LEFT_PAREN, TOKEN_RIGHT_PAREN,
@@ -38,8 +40,18 @@ typedef struct {
 
 } Scanner;
 
-void initScanner(const char* source);
-Token scanToken();
+typedef struct {
+	// Every token of a source in order, ending with TOKEN_EOF
+	Token* tokens;
+	int count;
+	int capacity;
+} TokenArray;
+
+void initScanner(Scanner* scanner, const char* source);
+Token scanToken(Scanner* scanner);
+void initTokenArray(TokenArray* array);
+void freeTokenArray(TokenArray* array);
+void scanTokens(const char* source, TokenArray* array, int threadCount);
 
 #endif
 
@@ -0,0 +1,161 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "../memory/memory.h"
+#include "../objects/objects.h"
+#include "table.h"
+
+#define TABLE_MAX_LOAD 0.75
+
+void initTable(Table* table) {
+	table->count = 0;
+	table->capacity = 0;
+	table->entries = NULL;
+}
+
+void freeTable(VM* vm, Table* table) {
+	FREE_ARRAY(vm, Entry, table->entries, table->capacity);
+	initTable(table);
+}
+
+static Entry* findEntry(Entry* entries, int capacity, ObjString* key) {
+	// Open addressing with linear probing - capacity is always a power of two so the modulo is a mask.
+	// Keys are interned, so comparing the pointers is enough to compare the strings
+	uint32_t index = key->hash & (capacity - 1);
+	Entry* tombstone = NULL;
+
+	for (;;) {
+		Entry* entry = &entries[index];
+		if (entry->key == NULL) {
+			if (IS_NIL(entry->value)) {
+				// Truly empty - reuse an earlier tombstone if we passed one
+				return tombstone != NULL ? tombstone : entry;
+			}
+			if (tombstone == NULL) tombstone = entry;
+		}
+		else if (entry->key == key) {
+			return entry;
+		}
+
+		index = (index + 1) & (capacity - 1);
+	}
+}
+
+static void adjustCapacity(VM* vm, Table* table, int capacity) {
+	Entry* entries = ALLOCATE(vm, Entry, capacity);
+	for (int i = 0; i < capacity; i++) {
+		entries[i].key = NULL;
+		entries[i].value = NIL_VAL;
+	}
+
+	// Re-insert everything since the bucket depends on the capacity - tombstones are dropped along the way
+	table->count = 0;
+	for (int i = 0; i < table->capacity; i++) {
+		Entry* entry = &table->entries[i];
+		if (entry->key == NULL) continue;
+
+		Entry* dest = findEntry(entries, capacity, entry->key);
+		dest->key = entry->key;
+		dest->value = entry->value;
+		table->count++;
+	}
+
+	FREE_ARRAY(vm, Entry, table->entries, table->capacity);
+	table->entries = entries;
+	table->capacity = capacity;
+}
+
+bool tableGet(Table* table, ObjString* key, Value* value) {
+	if (table->count == 0) return false;
+
+	Entry* entry = findEntry(table->entries, table->capacity, key);
+	if (entry->key == NULL) return false;
+
+	*value = entry->value;
+	return true;
+}
+
+static int liveEntries(Table* table) {
+	int live = 0;
+	for (int i = 0; i < table->capacity; i++) {
+		if (table->entries[i].key != NULL) live++;
+	}
+	return live;
+}
+
+bool tableSet(VM* vm, Table* table, ObjString* key, Value value) {
+	if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
+		// When the load is mostly tombstones - the collector leaves plenty in the intern table - clearing
+		// them out at the same size is enough, otherwise the table would double after every collection
+		bool crowded = liveEntries(table) + 1 > table->capacity * TABLE_MAX_LOAD / 2;
+		adjustCapacity(vm, table, crowded ? GROW_CAPACITY(table->capacity) : table->capacity);
+	}
+
+	Entry* entry = findEntry(table->entries, table->capacity, key);
+	bool isNewKey = entry->key == NULL;
+	if (isNewKey && IS_NIL(entry->value)) table->count++; // reused tombstones are already counted
+
+	entry->key = key;
+	entry->value = value;
+	return isNewKey;
+}
+
+bool tableDelete(Table* table, ObjString* key) {
+	if (table->count == 0) return false;
+
+	Entry* entry = findEntry(table->entries, table->capacity, key);
+	if (entry->key == NULL) return false;
+
+	// Leave a tombstone so probe sequences running through this bucket don't stop early
+	entry->key = NULL;
+	entry->value = BOOL_VAL(true);
+	return true;
+}
+
+ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash) {
+	// The one lookup that compares characters - it's how a new string finds its interned twin
+	if (table->count == 0) return NULL;
+
+	uint32_t index = hash & (table->capacity - 1);
+	for (;;) {
+		Entry* entry = &table->entries[index];
+		if (entry->key == NULL) {
+			// Stop at an empty bucket, keep going past tombstones
+			if (IS_NIL(entry->value)) return NULL;
+		}
+		else if (entry->key->length == length &&
+			entry->key->hash == hash &&
+			memcmp(entry->key->chars, chars, length) == 0) {
+			return entry->key;
+		}
+
+		index = (index + 1) & (table->capacity - 1);
+	}
+}
+
+void tableRemoveWhite(Table* table) {
+	// Drops the keys the collector is about to free - called between marking and sweeping
+	tableRemoveWhiteIn(table, 0, table->capacity);
+}
+
+void tableRemoveWhiteIn(Table* table, int start, int end) {
+	// Only entries [start, end) are written, so disjoint ranges can be cleared by different threads
+	for (int i = start; i < end; i++) {
+		Entry* entry = &table->entries[i];
+		if (entry->key != NULL && !entry->key->obj.isMarked) {
+			entry->key = NULL;
+			entry->value = BOOL_VAL(true); // a tombstone, as tableDelete() leaves
+		}
+	}
+}
+
+bool tableReplaceKey(Table* table, ObjString* key, ObjString* replacement) {
+	// For an object that moved - replacement has the same characters and hash, so it takes the same bucket
+	if (table->count == 0) return false;
+
+	Entry* entry = findEntry(table->entries, table->capacity, key);
+	if (entry->key != key) return false;
+
+	entry->key = replacement;
+	return true;
+}
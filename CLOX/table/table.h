@@ -0,0 +1,28 @@
+#ifndef clox_table_h
+#define clox_table_h
+
+#include "../common.h"
+#include "../value/value.h"
+
+typedef struct {
+	ObjString* key;
+	Value value;
+} Entry;
+
+typedef struct {
+	int count; // live entries plus tombstones
+	int capacity;
+	Entry* entries;
+} Table;
+
+void initTable(Table* table);
+void freeTable(VM* vm, Table* table);
+bool tableGet(Table* table, ObjString* key, Value* value);
+bool tableSet(VM* vm, Table* table, ObjString* key, Value value);
+bool tableDelete(Table* table, ObjString* key);
+ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash);
+void tableRemoveWhite(Table* table);
+void tableRemoveWhiteIn(Table* table, int start, int end);
+bool tableReplaceKey(Table* table, ObjString* key, ObjString* replacement);
+
+#endif
@@ -4,6 +4,7 @@
 #include "../memory/memory.h"
 #include "value.h"
 #include "../objects/objects.h"
+#include "../vm/vm.h"
 
 void initValueArray(ValueArray* array) {
 	array->capacity = 0;
@@ -11,45 +12,47 @@ void initValueArray(ValueArray* array) {
 	array->values = NULL;
 }
 
-void writeValueArray(ValueArray* array, Value value) {
+void writeValueArray(VM* vm, ValueArray* array, Value value) {
 
 	if (array->capacity < array->count + 1) {
 		int oldCapacity = array->capacity;
 		array->capacity = GROW_CAPACITY(oldCapacity);
-		array->values = GROW_ARRAY(Value, array->values, oldCapacity, array->capacity);
+		array->values = GROW_ARRAY(vm, Value, array->values, oldCapacity, array->capacity);
 	}
 
 	array->values[array->count] = value;
 	array->count++;
 }
 
-void freeValueArray(ValueArray* array) {
-	FREE_ARRAY(Value, array->values, array->capacity);
+void freeValueArray(VM* vm, ValueArray* array) {
+	FREE_ARRAY(vm, Value, array->values, array->capacity);
 	initValueArray(array);
 } 
 
-void printValue(Value value) {
-	switch (value.type) {
-		case VAL_BOOL: printf(AS_BOOL(value) ? "true" : "false"); break;
-		case VAL_NIL: printf("nil"); break;
-		case VAL_NUMBER: printf("%g", AS_NUMBER(value)); break;
-		case VAL_OBJ: printObject(value); break;
+void printValue(VM* vm, Value value) {
+	// Only the IS_/AS_ macros are used here so the same code works with and without NAN_BOXING
+	if (IS_BOOL(value)) {
+		fprintf(vm->output, AS_BOOL(value) ? "true" : "false");
+	} else if (IS_NIL(value)) {
+		fprintf(vm->output, "nil");
+	} else if (IS_NUMBER(value)) {
+		fprintf(vm->output, "%g", AS_NUMBER(value));
+	} else if (IS_OBJ(value)) {
+		printObject(vm, value);
 	}
 }
 
-bool valuesEqual(Value a, Value b) {
-	if (a.type != b.type) return false;
-	switch (a.type) {
-		case VAL_BOOL: return AS_BOOL(a) == AS_BOOL(b);
-		case VAL_NIL: return true;
-		case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b); 
-		case VAL_OBJ: {
-			ObjString* aString = AS_STRING(a);
-			ObjString* bString = AS_STRING(b);
-			return aString->length == bString->length &&
-				memcpy(aString->chars, bString->chars, aString->length) == 0;
+bool valuesEqual(VM* vm, Value a, Value b) {
+	if (IS_NUMBER(a) && IS_NUMBER(b)) return AS_NUMBER(a) == AS_NUMBER(b); // NaN != NaN, so no bit compare
+	if (IS_BOOL(a) && IS_BOOL(b)) return AS_BOOL(a) == AS_BOOL(b);
+	if (IS_NIL(a) && IS_NIL(b)) return true;
+	if (IS_OBJ(a) && IS_OBJ(b)) {
+		if (IS_ROPE(a) || IS_ROPE(b)) {
+			// A rope has no identity of its own until it is flattened into its interned string
+			if (stringLength(AS_OBJ(a)) != stringLength(AS_OBJ(b))) return false;
+			return flattenString(vm, AS_OBJ(a)) == flattenString(vm, AS_OBJ(b));
 		}
-		default: return false;
+		return AS_OBJ(a) == AS_OBJ(b); // strings are interned
 	}
+	return false;
 }
-
@@ -1,11 +1,58 @@
 #ifndef clox_value_h
 #define clox_value_h
 
+#include <string.h>
+
 #include "../common.h"
 
 typedef struct Obj Obj;
 typedef struct ObjString ObjString;
 
+#ifdef NAN_BOXING
+
+// Every double that isn't a quiet NaN is stored as itself. The rest of the Value types live
+// inside the unused bits of a quiet NaN - objects set the sign bit and keep their pointer in the
+// low 48 bits, while nil/true/false are small tags in the lowest bits
+#define SIGN_BIT	((uint64_t)0x8000000000000000)
+#define QNAN		((uint64_t)0x7ffc000000000000)
+
+#define TAG_NIL		1 // 01
+#define TAG_FALSE	2 // 10
+#define TAG_TRUE	3 // 11
+
+typedef uint64_t Value;
+
+#define IS_BOOL(value)		(((value) | 1) == TRUE_VAL)
+#define IS_NIL(value)		((value) == NIL_VAL)
+#define IS_NUMBER(value)	(((value) & QNAN) != QNAN)
+#define IS_OBJ(value)		(((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+
+#define AS_BOOL(value)		((value) == TRUE_VAL)
+#define AS_NUMBER(value)	valueToNum(value)
+#define AS_OBJ(value)		((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+
+#define BOOL_VAL(b)			((b) ? TRUE_VAL : FALSE_VAL)
+#define FALSE_VAL			((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL			((Value)(uint64_t)(QNAN | TAG_TRUE))
+#define NIL_VAL				((Value)(uint64_t)(QNAN | TAG_NIL))
+#define NUMBER_VAL(num)		numToValue(num)
+#define OBJ_VAL(obj)		(Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
+
+static inline double valueToNum(Value value) {
+	// memcpy is the well-defined way to reinterpret the bits - compilers turn it into a plain move
+	double num;
+	memcpy(&num, &value, sizeof(Value));
+	return num;
+}
+
+static inline Value numToValue(double num) {
+	Value value;
+	memcpy(&value, &num, sizeof(double));
+	return value;
+}
+
+#else
+
 typedef enum { // Only VM defined types here - not user-defined 
 	VAL_BOOL,
 	VAL_NIL,
@@ -36,17 +83,19 @@ typedef struct {
 #define NUMBER_VAL(value)	((Value){VAL_NUMBER, {.number = value}})
 #define OBJ_VAL(object)		((Value){VAL_OBJ, {.obj = (Obj*)object}})
 
+#endif
+
 typedef struct {
 	int capacity;
 	int count;
 	Value* values;
 } ValueArray;
 
-bool valuesEqual(Value a, Value b);
+bool valuesEqual(VM* vm, Value a, Value b);
 void initValueArray(ValueArray* array);
-void writeValueArray(ValueArray* array, Value value);
-void freeValueArray(ValueArray* array);
-void printValue(Value value);
+void writeValueArray(VM* vm, ValueArray* array, Value value);
+void freeValueArray(VM* vm, ValueArray* array);
+void printValue(VM* vm, Value value);
 
 #endif
 
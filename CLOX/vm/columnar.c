@@ -0,0 +1,309 @@
+#include <string.h>
+
+#include "../common.h"
+#include "columnar.h"
+#include "../memory/memory.h"
+
+// Build with -mavx for 4 doubles per instruction, or define NO_SIMD_COLUMNS for the plain loops
+#if defined(NO_SIMD_COLUMNS)
+#elif defined(__AVX__)
+#include <immintrin.h>
+#define COLUMN_LANES 4
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define COLUMN_LANES 2
+#endif
+
+// The comparisons match the scalar loop exactly: >= and <= are the negated < and > (so NaN gives true),
+// and != is the negated == - hence the unordered predicates for those three
+#if COLUMN_LANES == 4
+typedef __m256d Lanes;
+#define LANES_LOAD(pointer)			_mm256_loadu_pd(pointer)
+#define LANES_STORE(pointer, lanes)	_mm256_storeu_pd(pointer, lanes)
+#define LANES_SPLAT(x)				_mm256_set1_pd(x)
+#define LANES_ADD(a, b)				_mm256_add_pd(a, b)
+#define LANES_SUBTRACT(a, b)		_mm256_sub_pd(a, b)
+#define LANES_MULTIPLY(a, b)		_mm256_mul_pd(a, b)
+#define LANES_DIVIDE(a, b)			_mm256_div_pd(a, b)
+#define LANES_AND(a, b)				_mm256_and_pd(a, b)
+#define LANES_XOR(a, b)				_mm256_xor_pd(a, b)
+#define LANES_LESS(a, b)			_mm256_cmp_pd(a, b, _CMP_LT_OQ)
+#define LANES_GREATER(a, b)			_mm256_cmp_pd(a, b, _CMP_GT_OQ)
+#define LANES_NOT_LESS(a, b)		_mm256_cmp_pd(a, b, _CMP_NLT_UQ)
+#define LANES_NOT_GREATER(a, b)		_mm256_cmp_pd(a, b, _CMP_NGT_UQ)
+#define LANES_EQUAL(a, b)			_mm256_cmp_pd(a, b, _CMP_EQ_OQ)
+#define LANES_NOT_EQUAL(a, b)		_mm256_cmp_pd(a, b, _CMP_NEQ_UQ)
+#elif COLUMN_LANES == 2
+typedef __m128d Lanes;
+#define LANES_LOAD(pointer)			_mm_loadu_pd(pointer)
+#define LANES_STORE(pointer, lanes)	_mm_storeu_pd(pointer, lanes)
+#define LANES_SPLAT(x)				_mm_set1_pd(x)
+#define LANES_ADD(a, b)				_mm_add_pd(a, b)
+#define LANES_SUBTRACT(a, b)		_mm_sub_pd(a, b)
+#define LANES_MULTIPLY(a, b)		_mm_mul_pd(a, b)
+#define LANES_DIVIDE(a, b)			_mm_div_pd(a, b)
+#define LANES_AND(a, b)				_mm_and_pd(a, b)
+#define LANES_XOR(a, b)				_mm_xor_pd(a, b)
+#define LANES_LESS(a, b)			_mm_cmplt_pd(a, b)
+#define LANES_GREATER(a, b)			_mm_cmpgt_pd(a, b)
+#define LANES_NOT_LESS(a, b)		_mm_cmpnlt_pd(a, b)
+#define LANES_NOT_GREATER(a, b)		_mm_cmpngt_pd(a, b)
+#define LANES_EQUAL(a, b)			_mm_cmpeq_pd(a, b)
+#define LANES_NOT_EQUAL(a, b)		_mm_cmpneq_pd(a, b)
+#endif
+
+#ifdef COLUMN_LANES
+// Comparison masks are all ones or all zeros - AND-ing with 1.0 turns them into the 0.0/1.0 bools columns hold
+#define LANES_BOOL(mask) LANES_AND(mask, LANES_SPLAT(1.0))
+
+#define VECTOR_LOOP(vectorExpr) \
+		for (; i + COLUMN_LANES <= count; i += COLUMN_LANES) { \
+			Lanes x = LANES_LOAD(a + i); \
+			Lanes y = LANES_LOAD(b + i); \
+			LANES_STORE(out + i, vectorExpr); \
+		}
+#define UNARY_VECTOR_LOOP(vectorExpr) \
+		for (; i + COLUMN_LANES <= count; i += COLUMN_LANES) { \
+			Lanes x = LANES_LOAD(a + i); \
+			LANES_STORE(out + i, vectorExpr); \
+		}
+#else
+#define VECTOR_LOOP(vectorExpr)
+#define UNARY_VECTOR_LOOP(vectorExpr)
+#endif
+
+// out[i] = a[i] op b[i]. The scalar tail also covers whole blocks when there is no SIMD
+#define BINARY_KERNEL(name, vectorExpr, scalarExpr) \
+		static void name(double* out, const double* a, const double* b, int count) { \
+			int i = 0; \
+			VECTOR_LOOP(vectorExpr) \
+			for (; i < count; i++) { \
+				double x = a[i]; \
+				double y = b[i]; \
+				out[i] = (scalarExpr); \
+			} \
+		}
+
+#define UNARY_KERNEL(name, vectorExpr, scalarExpr) \
+		static void name(double* out, const double* a, int count) { \
+			int i = 0; \
+			UNARY_VECTOR_LOOP(vectorExpr) \
+			for (; i < count; i++) { \
+				double x = a[i]; \
+				out[i] = (scalarExpr); \
+			} \
+		}
+
+BINARY_KERNEL(addColumns,		LANES_ADD(x, y),						x + y)
+BINARY_KERNEL(subtractColumns,	LANES_SUBTRACT(x, y),					x - y)
+BINARY_KERNEL(multiplyColumns,	LANES_MULTIPLY(x, y),					x * y)
+BINARY_KERNEL(divideColumns,	LANES_DIVIDE(x, y),						x / y)
+BINARY_KERNEL(lessColumns,		LANES_BOOL(LANES_LESS(x, y)),			(double)(x < y))
+BINARY_KERNEL(greaterColumns,	LANES_BOOL(LANES_GREATER(x, y)),		(double)(x > y))
+BINARY_KERNEL(notLessColumns,	LANES_BOOL(LANES_NOT_LESS(x, y)),		(double)!(x < y))
+BINARY_KERNEL(notGreaterColumns, LANES_BOOL(LANES_NOT_GREATER(x, y)),	(double)!(x > y))
+BINARY_KERNEL(equalColumns,		LANES_BOOL(LANES_EQUAL(x, y)),			(double)(x == y))
+BINARY_KERNEL(notEqualColumns,	LANES_BOOL(LANES_NOT_EQUAL(x, y)),		(double)!(x == y))
+
+// Negation flips the sign bit so that -0 comes out as -0, which 0 - x would not do
+UNARY_KERNEL(negateColumn,		LANES_XOR(x, LANES_SPLAT(-0.0)),		-x)
+UNARY_KERNEL(notColumn,			LANES_SUBTRACT(LANES_SPLAT(1.0), x),	1.0 - x)
+
+static void fillColumn(double* out, double value, int count) {
+	for (int i = 0; i < count; i++) out[i] = value;
+}
+
+typedef enum {
+	COLUMN_NUMBER,
+	COLUMN_BOOL,
+} ColumnType;
+
+typedef struct {
+	// One stack slot (or input) for every row of the block
+	ColumnType type;
+	const double* values;	// the slot's own storage, or the input column OP_GET_INPUT loaded
+	double* storage;		// COLUMN_BLOCK doubles. Bools are 0.0 and 1.0, so every kernel is plain double maths
+} Column;
+
+static bool loadColumn(const Value* values, int count, Column* column) {
+	// Only a column holding one type throughout can be vectorized
+	if (IS_NUMBER(values[0])) {
+		for (int i = 0; i < count; i++) {
+			if (!IS_NUMBER(values[i])) return false;
+			column->storage[i] = AS_NUMBER(values[i]);
+		}
+		column->type = COLUMN_NUMBER;
+	}
+	else if (IS_BOOL(values[0])) {
+		for (int i = 0; i < count; i++) {
+			if (!IS_BOOL(values[i])) return false;
+			column->storage[i] = AS_BOOL(values[i]) ? 1.0 : 0.0;
+		}
+		column->type = COLUMN_BOOL;
+	}
+	else {
+		return false;
+	}
+
+	column->values = column->storage;
+	return true;
+}
+
+static Column* runBlock(Chunk* chunk, Column* inputs, Column* stack, double* scratch, int count) {
+	// Interprets the chunk once for the whole block - every instruction is one kernel call over count rows.
+	// Returns the column OP_RETURN leaves, or NULL as soon as something needs the scalar loop: strings,
+	// nil, or operands the VM would report a runtime error for
+	Column* top = stack;
+	uint8_t* ip = chunk->code;
+
+	#define READ_CONSTANT() (chunk->constants.values[*ip++])
+	#define BINARY(kernel, operandType, resultType) \
+			do { \
+				Column* b = --top; \
+				Column* a = top - 1; \
+				if (a->type != (operandType) || b->type != (operandType)) return NULL; \
+				kernel(a->storage, a->values, b->values, count); \
+				a->values = a->storage; \
+				a->type = (resultType); \
+			} while (false)
+	#define EQUALITY(kernel, differentTypes) \
+			do { \
+				Column* b = --top; \
+				Column* a = top - 1; \
+				if (a->type == b->type) kernel(a->storage, a->values, b->values, count); \
+				else fillColumn(a->storage, (differentTypes), count); /* a number never equals a bool */ \
+				a->values = a->storage; \
+				a->type = COLUMN_BOOL; \
+			} while (false)
+	#define CONSTANT_BINARY(kernel) \
+			do { \
+				Value constant = READ_CONSTANT(); \
+				Column* a = top - 1; \
+				if (!IS_NUMBER(constant) || a->type != COLUMN_NUMBER) return NULL; \
+				fillColumn(scratch, AS_NUMBER(constant), count); \
+				kernel(a->storage, a->values, scratch, count); \
+				a->values = a->storage; \
+			} while (false)
+	#define PUSH_FILLED(value, columnType) \
+			do { \
+				fillColumn(top->storage, (value), count); \
+				top->values = top->storage; \
+				top->type = (columnType); \
+				top++; \
+			} while (false)
+
+	for (;;) {
+		uint8_t instruction = *ip++;
+		switch (instruction) {
+			case OP_CONSTANT:
+			case OP_CONSTANT_LONG: {
+				Value constant;
+				if (instruction == OP_CONSTANT) {
+					constant = READ_CONSTANT();
+				}
+				else {
+					constant = chunk->constants.values[ip[0] | (ip[1] << 8) | (ip[2] << 16)];
+					ip += 3;
+				}
+				if (!IS_NUMBER(constant)) return NULL;
+				PUSH_FILLED(AS_NUMBER(constant), COLUMN_NUMBER);
+				break;
+			}
+			case OP_TRUE:  PUSH_FILLED(1.0, COLUMN_BOOL); break;
+			case OP_FALSE: PUSH_FILLED(0.0, COLUMN_BOOL); break;
+			case OP_GET_INPUT: {
+				Column* input = &inputs[*ip++];
+				top->values = input->values; // read in place - the first kernel writes to the slot's own storage
+				top->type = input->type;
+				top++;
+				break;
+			}
+			case OP_ADD:			BINARY(addColumns, COLUMN_NUMBER, COLUMN_NUMBER); break;
+			case OP_SUBTRACT:		BINARY(subtractColumns, COLUMN_NUMBER, COLUMN_NUMBER); break;
+			case OP_MULTIPLY:		BINARY(multiplyColumns, COLUMN_NUMBER, COLUMN_NUMBER); break;
+			case OP_DIVIDE:			BINARY(divideColumns, COLUMN_NUMBER, COLUMN_NUMBER); break;
+			case OP_LESS:			BINARY(lessColumns, COLUMN_NUMBER, COLUMN_BOOL); break;
+			case OP_GREATER:		BINARY(greaterColumns, COLUMN_NUMBER, COLUMN_BOOL); break;
+			case OP_GREATER_EQUAL:	BINARY(notLessColumns, COLUMN_NUMBER, COLUMN_BOOL); break;
+			case OP_LESS_EQUAL:		BINARY(notGreaterColumns, COLUMN_NUMBER, COLUMN_BOOL); break;
+			case OP_EQUAL:			EQUALITY(equalColumns, 0.0); break;
+			case OP_NOT_EQUAL:		EQUALITY(notEqualColumns, 1.0); break;
+			case OP_ADD_CONSTANT:		CONSTANT_BINARY(addColumns); break;
+			case OP_SUBTRACT_CONSTANT:	CONSTANT_BINARY(subtractColumns); break;
+			case OP_MULTIPLY_CONSTANT:	CONSTANT_BINARY(multiplyColumns); break;
+			case OP_DIVIDE_CONSTANT:	CONSTANT_BINARY(divideColumns); break;
+			case OP_NEGATE: {
+				Column* a = top - 1;
+				if (a->type != COLUMN_NUMBER) return NULL;
+				negateColumn(a->storage, a->values, count);
+				a->values = a->storage;
+				break;
+			}
+			case OP_NOT: {
+				// Numbers are always truthy, so !number is false on every row
+				Column* a = top - 1;
+				if (a->type == COLUMN_BOOL) notColumn(a->storage, a->values, count);
+				else fillColumn(a->storage, 0.0, count);
+				a->values = a->storage;
+				a->type = COLUMN_BOOL;
+				break;
+			}
+			case OP_RETURN:
+				return top - 1;
+			default:
+				return NULL; // OP_NIL and anything added later
+		}
+	}
+
+	#undef READ_CONSTANT
+	#undef BINARY
+	#undef EQUALITY
+	#undef CONSTANT_BINARY
+	#undef PUSH_FILLED
+}
+
+InterpretResult runProgramColumns(VM* vm, Program* program, const Value* inputs, int rowCount, Value* results) {
+	Chunk* chunk = &program->chunk;
+	int inputCount = chunk->inputCount;
+	vm->stats.columnRows = 0;
+	if (rowCount <= 0) return INTERPRET_OK;
+
+	// Every column plus one scratch column for the constant operand of the *_CONSTANT instructions
+	int columnCount = inputCount + chunk->maxStackDepth;
+	double* storage = ALLOCATE(vm, double, (size_t)(columnCount + 1) * COLUMN_BLOCK);
+	Column* columns = ALLOCATE(vm, Column, columnCount);
+	for (int i = 0; i < columnCount; i++) columns[i].storage = storage + (size_t)i * COLUMN_BLOCK;
+	double* scratch = storage + (size_t)columnCount * COLUMN_BLOCK;
+	Value* rowInputs = inputCount > 0 ? ALLOCATE(vm, Value, inputCount) : NULL;
+
+	InterpretResult status = INTERPRET_OK;
+	for (int start = 0; start < rowCount && status == INTERPRET_OK; start += COLUMN_BLOCK) {
+		int count = rowCount - start < COLUMN_BLOCK ? rowCount - start : COLUMN_BLOCK;
+
+		bool vectorized = true;
+		for (int i = 0; i < inputCount && vectorized; i++) {
+			vectorized = loadColumn(inputs + (size_t)i * rowCount + start, count, &columns[i]);
+		}
+		Column* result = vectorized ? runBlock(chunk, columns, columns + inputCount, scratch, count) : NULL;
+
+		if (result != NULL) {
+			for (int row = 0; row < count; row++) {
+				results[start + row] = result->type == COLUMN_NUMBER ?
+					NUMBER_VAL(result->values[row]) : BOOL_VAL(result->values[row] != 0.0);
+			}
+			vm->stats.columnRows += count;
+			continue;
+		}
+
+		// The scalar loop gives the exact result or runtime error for rows the kernels can't handle
+		for (int row = 0; row < count && status == INTERPRET_OK; row++) {
+			for (int i = 0; i < inputCount; i++) rowInputs[i] = inputs[(size_t)i * rowCount + start + row];
+			status = runProgramKeepingObjects(vm, program, rowInputs, &results[start + row]);
+		}
+	}
+
+	if (rowInputs != NULL) FREE_ARRAY(vm, Value, rowInputs, inputCount);
+	FREE_ARRAY(vm, Column, columns, columnCount);
+	FREE_ARRAY(vm, double, storage, (size_t)(columnCount + 1) * COLUMN_BLOCK);
+	return status;
+}
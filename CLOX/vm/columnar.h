@@ -0,0 +1,15 @@
+#ifndef clox_columnar_h
+#define clox_columnar_h
+
+#include "vm.h"
+
+#define COLUMN_BLOCK 1024 // rows interpreted together - one column of doubles per stack slot stays in L1/L2
+
+// Evaluates a program over rowCount records at once. inputs is column-major: the value of input i for
+// row r is inputs[i * rowCount + r]. Blocks whose input columns are all numbers or all bools, and whose
+// bytecode only does arithmetic, comparisons and logic on them, are interpreted once per block with
+// vector kernels. Any other block falls back to the scalar loop row by row, so the results (and errors)
+// are always what runProgram() would give. On a runtime error the rows before the failing one have results
+InterpretResult runProgramColumns(VM* vm, Program* program, const Value* inputs, int rowCount, Value* results);
+
+#endif
@@ -0,0 +1,78 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "profiler.h"
+#include "../disassemmbler/disassemble.h"
+
+#define PROFILE_TOP_PAIRS 20
+
+typedef struct {
+	int first;
+	int second; // -1 for single opcodes
+	uint64_t count;
+} ProfileRow;
+
+void initProfile(Profile* profile) {
+	memset(profile, 0, sizeof(Profile));
+	profile->previous = -1;
+}
+
+void endProfileRun(Profile* profile) {
+	// The last instruction of a run has no successor to stop its clock, so stop it here
+	if (profile->previous >= 0) {
+		profile->cycles[profile->previous] += readCycles() - profile->previousStart;
+	}
+	profile->previous = -1;
+}
+
+static int compareRows(const void* a, const void* b) {
+	uint64_t countA = ((const ProfileRow*)a)->count;
+	uint64_t countB = ((const ProfileRow*)b)->count;
+	if (countA == countB) return 0;
+	return countA < countB ? 1 : -1; // most frequent first
+}
+
+void printProfile(Profile* profile, FILE* out) {
+	ProfileRow rows[OPCODE_COUNT * OPCODE_COUNT];
+	int rowCount = 0;
+	uint64_t totalCount = 0;
+	uint64_t totalCycles = 0;
+
+	for (int opcode = 0; opcode < OPCODE_COUNT; opcode++) {
+		if (profile->counts[opcode] == 0) continue;
+		rows[rowCount++] = (ProfileRow){ opcode, -1, profile->counts[opcode] };
+		totalCount += profile->counts[opcode];
+		totalCycles += profile->cycles[opcode];
+	}
+	qsort(rows, rowCount, sizeof(ProfileRow), compareRows);
+
+	fprintf(out, "== profile: %llu instructions, %llu %s ==\n",
+		(unsigned long long)totalCount, (unsigned long long)totalCycles, PROFILE_CLOCK_UNIT);
+	fprintf(out, "%-22s %12s %7s %14s %10s\n", "opcode", "count", "%", PROFILE_CLOCK_UNIT, "per op");
+	for (int i = 0; i < rowCount; i++) {
+		int opcode = rows[i].first;
+		fprintf(out, "%-22s %12llu %6.2f%% %14llu %10.1f\n", opcodeName((uint8_t)opcode),
+			(unsigned long long)rows[i].count, 100.0 * rows[i].count / totalCount,
+			(unsigned long long)profile->cycles[opcode], (double)profile->cycles[opcode] / rows[i].count);
+	}
+
+	// Pairs are what decides whether a superinstruction is worth adding
+	rowCount = 0;
+	uint64_t totalPairs = 0;
+	for (int first = 0; first < OPCODE_COUNT; first++) {
+		for (int second = 0; second < OPCODE_COUNT; second++) {
+			if (profile->pairs[first][second] == 0) continue;
+			rows[rowCount++] = (ProfileRow){ first, second, profile->pairs[first][second] };
+			totalPairs += profile->pairs[first][second];
+		}
+	}
+	if (rowCount == 0) return;
+	qsort(rows, rowCount, sizeof(ProfileRow), compareRows);
+
+	fprintf(out, "-- top opcode pairs --\n");
+	for (int i = 0; i < rowCount && i < PROFILE_TOP_PAIRS; i++) {
+		fprintf(out, "%-22s %-22s %12llu %6.2f%%\n", opcodeName((uint8_t)rows[i].first),
+			opcodeName((uint8_t)rows[i].second), (unsigned long long)rows[i].count,
+			100.0 * rows[i].count / totalPairs);
+	}
+}
@@ -0,0 +1,59 @@
+#ifndef clox_profiler_h
+#define clox_profiler_h
+
+#include <stdio.h>
+#include <time.h>
+#include "../common.h"
+#include "../chunk/chunk.h"
+
+// The time stamp counter is the cheapest clock there is, everything else falls back to nanoseconds
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define PROFILE_USE_TSC
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define PROFILE_USE_TSC
+#endif
+
+#ifdef PROFILE_USE_TSC
+#define PROFILE_CLOCK_UNIT "cycles"
+#else
+#define PROFILE_CLOCK_UNIT "ns"
+#endif
+
+typedef struct {
+	// Filled in by runInstrumented() - run() never touches it, so profiling costs nothing when it is off
+	uint64_t counts[OPCODE_COUNT];
+	uint64_t cycles[OPCODE_COUNT];				// time until the next instruction started, in PROFILE_CLOCK_UNIT
+	uint64_t pairs[OPCODE_COUNT][OPCODE_COUNT];	// [first][second] - how often second directly followed first
+	int previous;								// opcode of the instruction being timed, -1 between runs
+	uint64_t previousStart;
+} Profile;
+
+static inline uint64_t readCycles() {
+#ifdef PROFILE_USE_TSC
+	return __rdtsc();
+#else
+	struct timespec time;
+	timespec_get(&time, TIME_UTC);
+	return (uint64_t)time.tv_sec * 1000000000u + (uint64_t)time.tv_nsec;
+#endif
+}
+
+static inline void profileInstruction(Profile* profile, uint8_t opcode) {
+	// Called right before opcode is dispatched, which is also when the previous instruction finished
+	uint64_t now = readCycles();
+	if (profile->previous >= 0) {
+		profile->cycles[profile->previous] += now - profile->previousStart;
+		profile->pairs[profile->previous][opcode]++;
+	}
+	profile->counts[opcode]++;
+	profile->previous = opcode;
+	profile->previousStart = now;
+}
+
+void initProfile(Profile* profile);
+void endProfileRun(Profile* profile);
+void printProfile(Profile* profile, FILE* out);
+
+#endif
@@ -0,0 +1,224 @@
+// The body of the interpreter loop. vm->c includes this once per variant after defining
+// RUN_FUNCTION as the function name, plus RUN_INSTRUMENTED for the one that calls
+// instrumentInstruction() before every instruction. There is deliberately no include guard
+
+#ifdef COMPUTED_GOTO
+// goto *expr is a GNU extension like the label addresses in dispatchTable, but a statement, which
+// __extension__ can't be put on - so -Wpedantic is off for the loop instead
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+static InterpretResult RUN_FUNCTION(VM* vm) {
+	// The stack was sized from the chunk's maxStackDepth before we got here, so the stack
+	// top lives in a local (ideally a register) and pushes/pops never check for room
+	Value* stackTop = vm->stackTop;
+
+	#define READ_BYTE() (*vm->ip++) // returns an enum value (int)
+	#define READ_CONSTANT() (vm->chunk->constants.values[READ_BYTE()]) 
+	#define READ_CONSTANT_LONG() \
+			(vm->ip += 3, vm->chunk->constants.values[vm->ip[-3] | (vm->ip[-2] << 8) | (vm->ip[-1] << 16)])
+	#define PUSH(value) (*stackTop++ = (value))
+	#define POP() (*--stackTop)
+	#define PEEK(distance) (stackTop[-1 - (distance)])
+	// After an instruction that may have allocated, once its result is on the stack. Collections move
+	// objects, so this is the only place one happens - no C local holds an object here
+	#define SAFEPOINT() \
+			do { \
+				if (vm->collectionDue) { \
+					vm->stackTop = stackTop; \
+					collectAtSafepoint(vm); \
+				} \
+			} while (false)
+	#define BINARY_OP(valueType, op) \
+			do { \
+				if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) { \
+					runtimeError(vm, "Operands must be numbers."); \
+					return INTERPRET_RUNTIME_ERROR; \
+				} \
+				double b = AS_NUMBER(POP()); \
+				double a = AS_NUMBER(POP()); \
+				PUSH(valueType(a op b)); \
+			} while (false);
+	#define NOT_BOOL_VAL(value) BOOL_VAL(!(value))
+	#define CONSTANT_OP(op) \
+			do { \
+				Value constant = READ_CONSTANT(); \
+				if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(constant)) { \
+					runtimeError(vm, "Operands must be numbers."); \
+					return INTERPRET_RUNTIME_ERROR; \
+				} \
+				PEEK(0) = NUMBER_VAL(AS_NUMBER(PEEK(0)) op AS_NUMBER(constant)); \
+			} while (false);
+
+	#ifdef RUN_INSTRUMENTED
+	#define INSTRUMENT_INSTRUCTION() \
+			do { \
+				vm->stackTop = stackTop; \
+				instrumentInstruction(vm); \
+			} while (false)
+	#else
+	#define INSTRUMENT_INSTRUCTION() ((void)0)
+	#endif
+
+	// Both dispatch modes share the opcode bodies below - only the way we get from one body
+	// to the next differs. With computed gotos every body ends in its own indirect jump, so the
+	// branch predictor gets a separate history per opcode instead of one shared switch jump
+	#ifdef COMPUTED_GOTO
+	__extension__ static void* dispatchTable[] = {
+		[OP_CONSTANT]		= &&op_OP_CONSTANT,
+		[OP_CONSTANT_LONG]	= &&op_OP_CONSTANT_LONG,
+		[OP_NIL]			= &&op_OP_NIL,
+		[OP_TRUE]			= &&op_OP_TRUE,
+		[OP_FALSE]			= &&op_OP_FALSE,
+		[OP_EQUAL]			= &&op_OP_EQUAL,
+		[OP_GREATER]		= &&op_OP_GREATER,
+		[OP_LESS]			= &&op_OP_LESS,
+		[OP_ADD]			= &&op_OP_ADD,
+		[OP_SUBTRACT]		= &&op_OP_SUBTRACT,
+		[OP_MULTIPLY]		= &&op_OP_MULTIPLY,
+		[OP_DIVIDE]			= &&op_OP_DIVIDE,
+		[OP_NOT]			= &&op_OP_NOT,
+		[OP_NEGATE]			= &&op_OP_NEGATE,
+		[OP_RETURN]			= &&op_OP_RETURN,
+		[OP_GET_INPUT]		= &&op_OP_GET_INPUT,
+		[OP_NOT_EQUAL]			= &&op_OP_NOT_EQUAL,
+		[OP_GREATER_EQUAL]		= &&op_OP_GREATER_EQUAL,
+		[OP_LESS_EQUAL]			= &&op_OP_LESS_EQUAL,
+		[OP_ADD_CONSTANT]		= &&op_OP_ADD_CONSTANT,
+		[OP_SUBTRACT_CONSTANT]	= &&op_OP_SUBTRACT_CONSTANT,
+		[OP_MULTIPLY_CONSTANT]	= &&op_OP_MULTIPLY_CONSTANT,
+		[OP_DIVIDE_CONSTANT]	= &&op_OP_DIVIDE_CONSTANT,
+	};
+
+	#define DISPATCH() \
+			do { \
+				INSTRUMENT_INSTRUCTION(); \
+				goto *dispatchTable[READ_BYTE()]; \
+			} while (false)
+	#define CASE(opcode) op_##opcode
+	#define NEXT DISPATCH()
+
+	DISPATCH();
+	#else
+	#define CASE(opcode) case opcode
+	#define NEXT break
+
+	for (;;) {
+		INSTRUMENT_INSTRUCTION();
+
+		uint8_t instruction;
+		switch (instruction = READ_BYTE()) {
+	#endif
+			CASE(OP_CONSTANT): {
+				Value constant = READ_CONSTANT(); 
+				PUSH(constant);
+				NEXT;
+			} 
+			CASE(OP_NIL): PUSH(NIL_VAL); NEXT;
+			CASE(OP_TRUE): PUSH(BOOL_VAL(true)); NEXT;
+			CASE(OP_FALSE): PUSH(BOOL_VAL(false)); NEXT;
+			CASE(OP_EQUAL): {
+				// Comparing ropes flattens them
+				bool equal = valuesEqual(vm, PEEK(1), PEEK(0));
+				stackTop--;
+				PEEK(0) = BOOL_VAL(equal);
+				SAFEPOINT();
+				NEXT;
+			}
+			CASE(OP_GREATER):  BINARY_OP(BOOL_VAL, > ); NEXT;
+			CASE(OP_LESS):     BINARY_OP(BOOL_VAL, < ); NEXT;
+			CASE(OP_CONSTANT_LONG): {
+				Value constant = READ_CONSTANT_LONG();
+				PUSH(constant);
+				NEXT;
+			}
+			CASE(OP_ADD): {
+				if (IS_STRING_OR_ROPE(PEEK(0)) && IS_STRING_OR_ROPE(PEEK(1))) { 
+					Obj* result = concatenate(vm, AS_OBJ(PEEK(1)), AS_OBJ(PEEK(0)));
+					stackTop--;
+					PEEK(0) = OBJ_VAL(result);
+					SAFEPOINT();
+				} else if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1))) {
+					double b = AS_NUMBER(POP());
+					double a = AS_NUMBER(POP());
+					PUSH(NUMBER_VAL(a + b));
+				} else {
+					runtimeError(vm, "Operands must be two numbers or two strings.");
+					return INTERPRET_RUNTIME_ERROR;
+				} 
+				NEXT;
+			}
+			CASE(OP_SUBTRACT):	BINARY_OP(NUMBER_VAL, -); NEXT;
+			CASE(OP_MULTIPLY):	BINARY_OP(NUMBER_VAL, *); NEXT;
+			CASE(OP_DIVIDE):	BINARY_OP(NUMBER_VAL, /); NEXT;
+			CASE(OP_NOT): PEEK(0) = BOOL_VAL(isFalsey(PEEK(0))); NEXT;
+			CASE(OP_NEGATE): {
+				if (!IS_NUMBER(PEEK(0))) {
+					runtimeError(vm, "Operand must be a number.");
+					return INTERPRET_RUNTIME_ERROR;
+				}
+				PEEK(0) = NUMBER_VAL(- AS_NUMBER(PEEK(0)));
+				NEXT;
+			}
+			CASE(OP_NOT_EQUAL): {
+				bool equal = valuesEqual(vm, PEEK(1), PEEK(0));
+				stackTop--;
+				PEEK(0) = BOOL_VAL(!equal);
+				SAFEPOINT();
+				NEXT;
+			}
+			// Written as the negation of the opposite comparison so NaN behaves exactly as the
+			// OP_LESS OP_NOT / OP_GREATER OP_NOT pairs these replace
+			CASE(OP_GREATER_EQUAL): BINARY_OP(NOT_BOOL_VAL, <); NEXT;
+			CASE(OP_LESS_EQUAL):	BINARY_OP(NOT_BOOL_VAL, >); NEXT;
+			CASE(OP_ADD_CONSTANT): {
+				Value constant = READ_CONSTANT();
+				if (IS_STRING(constant) && IS_STRING_OR_ROPE(PEEK(0))) {
+					PEEK(0) = OBJ_VAL(concatenate(vm, AS_OBJ(PEEK(0)), AS_OBJ(constant)));
+					SAFEPOINT();
+				} else if (IS_NUMBER(constant) && IS_NUMBER(PEEK(0))) {
+					PEEK(0) = NUMBER_VAL(AS_NUMBER(PEEK(0)) + AS_NUMBER(constant));
+				} else {
+					runtimeError(vm, "Operands must be two numbers or two strings.");
+					return INTERPRET_RUNTIME_ERROR;
+				}
+				NEXT;
+			}
+			CASE(OP_SUBTRACT_CONSTANT): CONSTANT_OP(-); NEXT;
+			CASE(OP_MULTIPLY_CONSTANT): CONSTANT_OP(*); NEXT;
+			CASE(OP_DIVIDE_CONSTANT):	CONSTANT_OP(/); NEXT;
+			CASE(OP_GET_INPUT): PUSH(vm->inputs[READ_BYTE()]); NEXT;
+			CASE(OP_RETURN): {
+				// Left for the caller - interpretChunk() prints it, runProgram() hands it back
+				vm->result = POP();
+				vm->stackTop = stackTop;
+				return INTERPRET_OK;
+			}
+	#ifndef COMPUTED_GOTO
+		}
+	} 
+	#endif
+
+	#undef READ_BYTE
+	#undef READ_CONSTANT
+	#undef READ_CONSTANT_LONG
+	#undef PUSH
+	#undef POP
+	#undef PEEK
+	#undef SAFEPOINT
+	#undef BINARY_OP
+	#undef NOT_BOOL_VAL
+	#undef CONSTANT_OP
+	#undef INSTRUMENT_INSTRUCTION
+	#undef DISPATCH
+	#undef CASE
+	#undef NEXT
+}
+
+#ifdef COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#endif
+
+#undef RUN_FUNCTION
+#undef RUN_INSTRUMENTED
@@ -9,60 +9,88 @@
 #include "../compiler/compiler.h"
 #include "../memory/memory.h"
 #include "../objects/objects.h"
+#include "profiler.h"
+#include "../image/cache.h"
 
-VM vm;
-bool foundConstantLong = false;
 
-static void resetStack() {
-	vm.stackCount = 0; // indicates that stack is now empty
+static InterpretResult run(VM* vm);
+static InterpretResult runInstrumented(VM* vm);
+
+static void resetStack(VM* vm) {
+	vm->stackTop = vm->stack; // indicates that stack is now empty
 }
 
-static void runtimeError(const char* format, ...) {
+static void runtimeError(VM* vm, const char* format, ...) {
 	va_list args; 
 	va_start(args, format);
-	vfprintf(stderr, format, args); // writes the arguments to the stderr stream
+	vfprintf(vm->errorOutput, format, args); // writes the arguments to the VM's error stream
 	va_end(args);
-	fputs("\n", stderr);
+	fputs("\n", vm->errorOutput);
+
+	size_t instructionIndex = vm->ip - vm->chunk->code - 1; // -1 since .ip points to the NEXT instruction 
+	int line = getLine(vm->chunk, instructionIndex);
+	fprintf(vm->errorOutput, "[line %d] in script\n", line); 
+	resetStack(vm);
+}
+
+static void reserveStack(VM* vm, int slots) {
+	// Grown once per chunk before run() - the instructions themselves never check for room
+	if (vm->stackCapacity >= slots) return;
 
-	size_t instructionIndex = vm.ip - vm.chunk->code - 1; // -1 since .ip points to the NEXT instruction 
-	int line = getLine(&vm.chunk, instructionIndex);
-	fprintf(stderr, "[line %d] in script\n", line); 
-	resetStack();
+	int oldCapacity = vm->stackCapacity;
+	vm->stackCapacity = slots;
+	vm->stack = GROW_ARRAY(vm, Value, vm->stack, oldCapacity, vm->stackCapacity);
+	resetStack(vm);
 }
 
-void initVM() {
-	vm.stack = NULL;
-	vm.stackCapacity = 0;
-	resetStack();
-	vm.objects = NULL;
+void initVM(VM* vm) {
+	memset(&vm->stats, 0, sizeof(VMStats));
+	memset(&vm->debug, 0, sizeof(VMDebug));
+	vm->cacheDirectory = NULL;
+	vm->output = stdout;
+	vm->errorOutput = stderr;
+	vm->lexThreads = 0;
+	vm->stack = NULL;
+	vm->stackCapacity = 0;
+	reserveStack(vm, STACK_MAX);
+	vm->objects = NULL;
+	initValueArray(&vm->pinned);
+	vm->inputs = NULL;
+	vm->result = NIL_VAL;
+	vm->canCollect = false;
+	vm->collectionDue = false;
+	vm->nextGC = GC_HEAP_MIN;
+	vm->grayStack = NULL;
+	vm->grayCount = 0;
+	vm->grayCapacity = 0;
+	vm->nursery = NULL;
+	vm->nurseryTop = NULL;
+	vm->remembered = NULL;
+	vm->rememberedCount = 0;
+	vm->rememberedCapacity = 0;
+	vm->markThreads = 3;
+	vm->sweep.running = false;
+	atomic_init(&vm->sweep.done, false);
+	initTable(&vm->strings);
 } 
 
-void freeVM() {
+void freeVM(VM* vm) {
 	// Free the dynamic stack array
-	FREE_ARRAY(Value, vm.stack, vm.stackCapacity);
-	freeObjects();
+	FREE_ARRAY(vm, Value, vm->stack, vm->stackCapacity);
+	freeValueArray(vm, &vm->pinned);
+	freeTable(vm, &vm->strings);
+	freeObjects(vm);
 }  
 
-void push(Value value) {
-
-	if (vm.stackCapacity < vm.stackCount + 1) { 
-		int oldCapacity = vm.stackCapacity;
-		vm.stackCapacity = GROW_CAPACITY(oldCapacity);
-		vm.stack = GROW_ARRAY(Value, vm.stack, oldCapacity, vm.stackCapacity);
-	}
-
-	vm.stack[vm.stackCount] = value;
-	vm.stackCount++;
+void push(VM* vm, Value value) {
+	// No capacity check - interpret() has already sized the stack for the chunk's maxStackDepth
+	*vm->stackTop = value;
+	vm->stackTop++;
 } 
  
-Value pop() {
-	vm.stackCount--;
-	return vm.stack[vm.stackCount];
-}
-
-static Value peek(int distance) {
-	// Subtracting 1 because stackCount keeps track of the next EMPTY slot in the stack
-	return vm.stack[vm.stackCount -1 - distance]; 
+Value pop(VM* vm) {
+	vm->stackTop--;
+	return *vm->stackTop;
 }
 
 static bool isFalsey(Value value) {
@@ -70,152 +98,184 @@ static bool isFalsey(Value value) {
 	return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
-static void concatenate() {
-	ObjString* b = AS_STRING(pop());
-	ObjString* a = AS_STRING(pop());
-
-	int length = a->length + b->length;
-	char* chars = ALLOCATE(char, length + 1);
-	memcpy(chars, a->chars, a->length);
-	memcpy(chars + a->length, b->chars, b->length);
-	chars[length] = '\0';
+static uint64_t nanoTime() {
+	// timespec_get is the only portable C11 clock with sub-second resolution
+	struct timespec time;
+	timespec_get(&time, TIME_UTC);
+	return (uint64_t)time.tv_sec * 1000000000u + (uint64_t)time.tv_nsec;
+}
 
-	ObjString* result = takeString(chars, length);
-	push(OBJ_VAL(result));
+static int countInstructions(Chunk* chunk, int endOffset) {
+	// There are no jumps, so the instructions before endOffset are exactly the ones that were dispatched
+	int count = 0;
+	for (int offset = 0; offset < endOffset; offset += instructionLength(chunk->code[offset])) count++;
+	return count;
 }
 
-InterpretResult interpret(const char* source) {
+InterpretResult interpret(VM* vm, const char* source) {
 	Chunk chunk;
 	initChunk(&chunk);
 
+	// A whole pass over the source, so only made for the report like the times
+	if (vm->debug.measure) vm->stats.sourceBytes = (int)strlen(source);
+	uint64_t compileStart = vm->debug.measure ? nanoTime() : 0;
+
+	// The same source always compiles to the same bytecode, so a cached image can stand in for compile()
+	Image image;
+	vm->stats.cacheHit = vm->cacheDirectory != NULL && loadCachedImage(vm, vm->cacheDirectory, source, &image);
+	if (vm->stats.cacheHit) {
+		if (vm->debug.measure) vm->stats.compileNanos = nanoTime() - compileStart;
+		InterpretResult result = interpretChunk(vm, &image.chunk);
+		freeImage(vm, &image);
+		return result;
+	}
+
 	// If chunk does not compile into bytecode without errors (SCANNER + COMPILER)
-	if (!compile(source, &chunk)) {
-		freeChunk(&chunk);
+	bool compiled = compile(vm, source, &chunk);
+	if (vm->debug.measure) vm->stats.compileNanos = nanoTime() - compileStart;
+
+	if (!compiled) {
+		vm->stats.runNanos = 0;
+		vm->stats.instructionsExecuted = 0;
+		freeChunk(vm, &chunk);
 		return INTERPRET_COMPILE_ERROR;
 	} 
 
-	// If no compilation error, we start the interpretation process (VM)
-	vm.chunk = &chunk;
-	vm.ip = vm.chunk->code;
-
-	InterpretResult result = run();
+	if (vm->cacheDirectory != NULL) storeCachedImage(vm->cacheDirectory, source, &chunk);
 
-	freeChunk(&chunk);
+	InterpretResult result = interpretChunk(vm, &chunk);
+	freeChunk(vm, &chunk);
 	return result;
 } 
 
-static void testStack(bool boolean) {
-	
-	struct timespec begin;
-	timespec_get(&begin, TIME_UTC);
-
-	if (boolean) { push(NUMBER_VAL(-AS_NUMBER(pop()))); }
-	else { vm.stack[vm.stackCount - 1] = NUMBER_VAL(- AS_NUMBER(vm.stack[vm.stackCount - 1])); }
-
-	struct timespec end;
-	timespec_get(&end, TIME_UTC);
-
-	double time_spent = (end.tv_nsec - begin.tv_nsec);
-	printf("RESULT: %f\n", time_spent);
-}
-
-static InterpretResult run() {
-
-	#define READ_BYTE() (*vm.ip++) // returns an enum value (int)
-	#define READ_CONSTANT() (vm.chunk->constants.values[READ_BYTE()]) 
-	#define BINARY_OP(valueType, op) \
-			do { \
-				if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
-					runtimeError("Operands must be numbers."); \
-					return INTERPRET_RUNTIME_ERROR; \
-				} \
-				double b = AS_NUMBER(pop()); \
-				double a = AS_NUMBER(pop()); \
-				push(valueType(a op b)); \
-			} while (false);
-
-	for (;;) {
-		
-		#ifdef DEBUG_TRACE_EXECUTION
-		printf("		");
-		for (Value* slot = vm.stack; slot < vm.stack + vm.stackCount; slot++) { // prints what is already present in the stack
-			printf("[ ");
-			printValue(*slot);
-			printf(" ]");
-		} 
-		printf("\n");
-
-		int offset = (int)(vm.ip - vm.chunk->code);
-		int prevInstruc = vm.chunk->code[offset - 2];
-		if (prevInstruc == OP_CONSTANT_LONG && foundConstantLong) {
-			// Since the OP_CONSTANT_LONG has a 3 byte operand 
-			// We've already read one of the operands so we skip the 2 to get to the next instruction
-			vm.ip += 2; 
-			foundConstantLong = false;
-		}
+static InterpretResult execute(VM* vm, Chunk* chunk, bool collect) {
+	vm->chunk = chunk;
+	vm->ip = vm->chunk->code;
+	reserveStack(vm, chunk->maxStackDepth);
+	resetStack(vm);
+
+	// Compiling never collects, so the start of a run is where garbage left by compiles gets noticed
+	vm->canCollect = collect;
+	if (collect) {
+		finishSweep(vm, false);
+		if (vm->debug.stressGC || vm->stats.bytesAllocated > vm->nextGC) collectGarbage(vm);
+	}
+
+	// Left out of the lean path - the clock and a second walk over the code cost about as much as a
+	// short program does, and runProgram() is called once per record
+	uint64_t runStart = vm->debug.measure ? nanoTime() : 0;
+	InterpretResult result;
+	if (vm->debug.traceExecution || vm->debug.profile != NULL || vm->debug.hook != NULL) {
+		result = runInstrumented(vm);
+		if (vm->debug.profile != NULL) endProfileRun(vm->debug.profile);
+	}
+	else {
+		result = run(vm);
+	}
+	if (vm->debug.measure) {
+		vm->stats.runNanos = nanoTime() - runStart;
+		vm->stats.instructionsExecuted = countInstructions(chunk, (int)(vm->ip - chunk->code));
+	}
+
+	// Promotion at the last safepoint - the result is all that survives, and nothing outside a run
+	// ever sees a young object
+	if (collect) collectYoung(vm);
+	vm->canCollect = false;
+	vm->collectionDue = false;
+
+	return result;
+}
+
+InterpretResult interpretChunk(VM* vm, Chunk* chunk) {
+	// Runs an already compiled (or loaded and verified) chunk and prints its result - the caller
+	// still owns the chunk afterwards
+	if (vm->debug.printCode) disassembleChunk(vm, chunk, "code");
 
-		disassembleInstruction(vm.chunk, (int)(vm.ip - vm.chunk->code)); // getting the offset
-		#endif
-
-		uint8_t instruction;
-		switch (instruction = READ_BYTE()) {
-			case OP_CONSTANT: {
-				Value constant = READ_CONSTANT(); 
-				push(constant);
-				break;
-			} 
-			case OP_NIL: push(NIL_VAL); break;
-			case OP_TRUE: push(BOOL_VAL(true)); break;
-			case OP_FALSE: push(BOOL_VAL(false)); break;
-			case OP_EQUAL: {
-				Value b = pop();
-				Value a = pop();
-				push(BOOL_VAL(valuesEqual(a, b)));
-				break;
-			}
-			case OP_GREATER:  BINARY_OP(BOOL_VAL, > ); break;
-			case OP_LESS:     BINARY_OP(BOOL_VAL, < ); break;
-			case OP_CONSTANT_LONG: {
-				foundConstantLong = true;
-  				Value constant = READ_CONSTANT();
-				push(constant);
-				break;
-			}
-			case OP_ADD: {
-				if (IS_STRING(peek(0)) && IS_STRING(peek(1))) { 
-					concatenate(); 
-				} else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-					double b = AS_NUMBER(pop());
-					double a = AS_NUMBER(pop());
-					push(NUMBER_VAL(a + b));
-				} else {
-					runtimeError("Operands must be two numbers or two strings.");
-					return INTERPRET_RUNTIME_ERROR;
-				} 
-				break;
-			}
-			case OP_SUBTRACT:	BINARY_OP(NUMBER_VAL, -); break;
-			case OP_MULTIPLY:	BINARY_OP(NUMBER_VAL, *); break;
-			case OP_DIVIDE:		BINARY_OP(NUMBER_VAL, /); break;
-			case OP_NOT: push(BOOL_VAL(isFalsey(pop()))); break;
-			case OP_NEGATE: {
-				if (!IS_NUMBER(peek(0))) {
-					runtimeError("Operand must be a number.");
-					return INTERPRET_RUNTIME_ERROR;
-				}
-				vm.stack[vm.stackCount - 1] = NUMBER_VAL(- AS_NUMBER(vm.stack[vm.stackCount - 1]));
-				break;
-			}
-			case OP_RETURN: {
-				printValue(pop());
-				printf("\n");
-				return INTERPRET_OK;
-			}
+	InterpretResult result = execute(vm, chunk, true);
+	if (result == INTERPRET_OK) {
+		printValue(vm, vm->result);
+		fputc('\n', vm->output);
+	}
+	return result;
+}
+
+bool compileProgram(VM* vm, const char* source, const char* const* inputNames, int inputCount, Program* program) {
+	initChunk(&program->chunk);
+	if (!compileWithInputs(vm, source, inputNames, inputCount, &program->chunk)) {
+		freeChunk(vm, &program->chunk);
+		return false;
+	}
+
+	// Pinned until freeProgram(), since runs of other chunks can't see this one's constants
+	ValueArray* constants = &program->chunk.constants;
+	for (int i = 0; i < constants->count; i++) {
+		if (IS_OBJ(constants->values[i])) writeValueArray(vm, &vm->pinned, constants->values[i]);
+	}
+
+	if (vm->debug.printCode) disassembleChunk(vm, &program->chunk, "program");
+	return true;
+}
+
+static InterpretResult runInputs(VM* vm, Program* program, const Value* inputs, Value* result, bool collect) {
+	vm->inputs = inputs;
+	InterpretResult status = execute(vm, &program->chunk, collect);
+	vm->inputs = NULL;
+
+	if (status == INTERPRET_OK && result != NULL) *result = vm->result;
+	return status;
+}
+
+InterpretResult runProgram(VM* vm, Program* program, const Value* inputs, Value* result) {
+	// Nothing is compiled or printed. The run may collect anything not reachable from its inputs, so
+	// the previous result stays valid only until this call unless it is passed back in
+	return runInputs(vm, program, inputs, result, true);
+}
+
+InterpretResult runProgramKeepingObjects(VM* vm, Program* program, const Value* inputs, Value* result) {
+	// For callers that run a program several times and need every result to stay valid until they are
+	// done - the run never collects, and a later runProgram() reclaims whatever is no longer needed
+	return runInputs(vm, program, inputs, result, false);
+}
+
+void freeProgram(VM* vm, Program* program) {
+	// Unpins one occurrence of each constant - another program may have pinned the same string
+	ValueArray* constants = &program->chunk.constants;
+	for (int i = 0; i < constants->count; i++) {
+		if (!IS_OBJ(constants->values[i])) continue;
+		for (int j = vm->pinned.count - 1; j >= 0; j--) {
+			if (AS_OBJ(vm->pinned.values[j]) != AS_OBJ(constants->values[i])) continue;
+			vm->pinned.values[j] = vm->pinned.values[--vm->pinned.count];
+			break;
 		}
+	}
+	freeChunk(vm, &program->chunk);
+}
+
+static void traceExecution(VM* vm) {
+	fprintf(vm->output, "		");
+	for (Value* slot = vm->stack; slot < vm->stackTop; slot++) { // prints what is already present in the stack
+		fprintf(vm->output, "[ ");
+		printValue(vm, *slot);
+		fprintf(vm->output, " ]");
 	} 
+	fprintf(vm->output, "\n");
 
-	#undef READ_BYTE
-	#undef READ_CONSTANT
-	#undef BINARY_OP
-} 
+	disassembleInstruction(vm, vm->chunk, (int)(vm->ip - vm->chunk->code)); // getting the offset
+}
+
+static void instrumentInstruction(VM* vm) {
+	// Called by runInstrumented() before each instruction, with vm->stackTop already synced
+	VMDebug* debug = &vm->debug;
+	if (debug->traceExecution) traceExecution(vm);
+	if (debug->profile != NULL) profileInstruction(debug->profile, *vm->ip);
+	if (debug->hook != NULL) debug->hook(vm, vm->chunk, (int)(vm->ip - vm->chunk->code));
+}
+
+// Both variants are generated from run_loop.h. run() is the production loop and has no
+// instrumentation compiled in at all - runInstrumented() is only picked when vm->debug asks for it
+#define RUN_FUNCTION run
+#include "run_loop.h"
 
+#define RUN_FUNCTION runInstrumented
+#define RUN_INSTRUMENTED
+#include "run_loop.h"
@@ -1,19 +1,85 @@
 #ifndef clox_vm_h
 #define clox_vm_h
 
+#include <stdio.h>
+
 #include "../chunk//chunk.h"
 #include "../value/value.h"
+#include "../table/table.h"
+#include "../memory/background.h"
+#include "profiler.h"
 
-#define STACK_MAX 256
+#define STACK_MAX 256 // slots allocated up front - chunks needing more grow the stack once before run()
 
 typedef struct {
+	// Measurements of the last interpret() call plus the running allocation totals from reallocate().
+	// The times, sourceBytes and the instruction count are only taken when debug.measure is set
+	uint64_t compileNanos;
+	uint64_t runNanos;
+	int sourceBytes;
+	int instructionsExecuted;
+	int columnRows;				// rows the last runProgramColumns() call evaluated with vector kernels
+	bool cacheHit;				// compileNanos was spent loading a cached image instead of compiling
+	size_t allocations;			// reallocate() calls that allocated or grew a block
+	size_t bytesAllocated;		// currently live
+	size_t peakBytesAllocated;
+	size_t collections;			// full garbage collections so far
+	size_t minorCollections;	// nursery collections, including the one at the end of every run
+	uint64_t gcPauseNanos;		// time the program was stopped for collections, in total
+	uint64_t maxGcPauseNanos;	// and for the longest one
+} VMStats;
+
+// Called by the instrumented loop before the instruction at offset runs
+typedef void (*InstructionHook)(VM* vm, Chunk* chunk, int offset);
+
+// Called after every collection with how long the program was stopped for it
+typedef void (*CollectionHook)(VM* vm, bool full, uint64_t pauseNanos);
+
+typedef struct {
+	// Everything here is off by default. Turning any of the run-time options on makes interpret()
+	// use the instrumented copy of the interpreter loop instead of the lean one
+	bool printCode;			// disassemble each chunk after compiling it
+	bool traceExecution;	// print the stack and each instruction as it runs
+	Profile* profile;		// per-opcode counts and timings, see profiler.h
+	InstructionHook hook;
+	bool stressGC;			// collect before every object allocation, to shake out values the collector can't see
+	CollectionHook collectionHook; // works with either loop - collections don't depend on the instrumentation
+	bool measure;			// fill in the times and instruction count in vm->stats - also either loop
+	bool noFolding;			// compile operators on literals as written, so benchmarks exercise the loop itself
+} VMDebug;
+
+struct VM {
+	// One interpreter. Nothing is shared between VMs, so separate ones can run on separate threads
 	Chunk* chunk;
 	uint8_t* ip; // points to the next instruction, not the one currently being handled
 	Value* stack;
 	int stackCapacity;
-	int stackCount; // points to where the NEXT value should go
-	Obj* objects;
-} VM;
+	Value* stackTop; // points to where the NEXT value should go
+	Table strings; // every live string, so equal strings share one object
+	Obj* objects; // every object in the old space, newest first
+	ValueArray pinned; // constants of every Program not yet freed - roots even while another chunk runs
+	const Value* inputs; // read by OP_GET_INPUT
+	Value result; // what OP_RETURN popped
+	bool canCollect; // only while execute() runs a chunk whose roots the collector knows about
+	bool collectionDue; // set by the allocator, acted on at run()'s next safepoint
+	size_t nextGC; // bytesAllocated that triggers the next full collection
+	Obj** grayStack; // the collector's worklist of objects still to trace
+	int grayCount;
+	int grayCapacity;
+	uint8_t* nursery; // NURSERY_SIZE bytes, allocated by the first run that makes an object
+	uint8_t* nurseryTop; // the young objects are [nursery, nurseryTop) - always empty between runs
+	Obj** remembered; // old objects the write barrier saw pointing into the nursery
+	int rememberedCount;
+	int rememberedCapacity;
+	int markThreads; // collector helpers for big heaps and intern tables, 0 to collect on this thread only
+	Sweep sweep; // the last full collection's, if it is still being freed in the background
+	VMStats stats;
+	const char* cacheDirectory; // where interpret() keeps compiled images keyed by source, NULL to always compile
+	FILE* output; // where the program's results (and --disassemble/--trace listings) go, stdout by default
+	FILE* errorOutput; // compile and runtime errors, stderr by default
+	int lexThreads; // 0 scans tokens as the parser asks for them, N scans them all first on up to N threads
+	VMDebug debug;
+};
 
 typedef enum {
 	INTERPRET_OK,
@@ -21,12 +87,21 @@ typedef enum {
 	INTERPRET_RUNTIME_ERROR
 } InterpretResult;
 
-extern VM vm;
+typedef struct {
+	// Source compiled once by compileProgram() and then run any number of times. Its identifiers are
+	// inputs - the i-th name given to compileProgram() reads inputs[i] of each runProgram() call
+	Chunk chunk;
+} Program;
 
-void initVM();
-void freeVM();
-InterpretResult interpret(const char* source);
-void push(Value value);
-Value pop();
+void initVM(VM* vm);
+void freeVM(VM* vm);
+InterpretResult interpret(VM* vm, const char* source);
+InterpretResult interpretChunk(VM* vm, Chunk* chunk);
+bool compileProgram(VM* vm, const char* source, const char* const* inputNames, int inputCount, Program* program);
+InterpretResult runProgram(VM* vm, Program* program, const Value* inputs, Value* result);
+InterpretResult runProgramKeepingObjects(VM* vm, Program* program, const Value* inputs, Value* result);
+void freeProgram(VM* vm, Program* program);
+void push(VM* vm, Value value);
+Value pop(VM* vm);
 
 #endif 
@@ -0,0 +1,217 @@
+#!/usr/bin/env python3
+"""Benchmark harness for the CLOX interpreter.
+
+Builds the interpreter with release flags, runs every script in
+bench/ plus a few generated large sources, and reports the median compile and run
+times, ops/sec, allocations and peak memory of each as JSON. Constant folding turns
+every script into a single constant, so each one also runs with --no-fold as
+"<name>_unfolded" - those are the entries that measure the interpreter loop. The
+"columnar" entry is bench/columnar.c, which evaluates one program over a million records with
+runProgramColumns() and reports its run_ns next to the row-by-row time. Passing
+--baseline compares against a previously saved report and exits with 1 on a regression.
+
+    python3 bench/bench.py --save results.json
+    python3 bench/bench.py --baseline results.json
+"""
+
+import argparse
+import glob
+import json
+import os
+import statistics
+import subprocess
+import sys
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+SOURCE_DIR = os.path.join(BENCH_DIR, "..", "CLOX")
+BUILD_DIR = os.path.join(BENCH_DIR, "build")
+
+# Metrics compared against the baseline. Times are noisy, so they get more slack than counts
+TIME_METRICS = ("compile_ns", "run_ns")
+COUNT_METRICS = ("allocations", "peak_bytes")
+
+
+def build(compiler):
+    os.makedirs(BUILD_DIR, exist_ok=True)
+    binary = os.path.join(BUILD_DIR, "clox")
+    sources = sorted(glob.glob(os.path.join(SOURCE_DIR, "**", "*.c"), recursive=True))
+    command = [compiler, "-std=c17", "-O2", "-DNDEBUG", "-o", binary] + sources + ["-lm", "-lpthread"]
+    subprocess.run(command, check=True)
+    return binary
+
+
+def build_columnar(compiler):
+    # The interpreter without its main.c, linked into the driver instead
+    os.makedirs(BUILD_DIR, exist_ok=True)
+    binary = os.path.join(BUILD_DIR, "columnar")
+    sources = sorted(glob.glob(os.path.join(SOURCE_DIR, "**", "*.c"), recursive=True))
+    sources = [source for source in sources if os.path.basename(source) != "main.c"]
+    command = [compiler, "-std=c17", "-O2", "-DNDEBUG", "-o", binary,
+               os.path.join(BENCH_DIR, "columnar.c")] + sources + ["-lm", "-lpthread"]
+    subprocess.run(command, check=True)
+    return binary
+
+
+def generate_large_sources():
+    # Written on demand instead of checked in - these are several MB each
+    directory = os.path.join(BUILD_DIR, "generated")
+    os.makedirs(directory, exist_ok=True)
+
+    arithmetic = os.path.join(directory, "large_arithmetic.lox")
+    with open(arithmetic, "w") as out:
+        out.write("0")
+        for i in range(200000):
+            out.write(" +\n(%d * %d - %d / %d)" % (i % 97, i % 13 + 1, i % 7, i % 5 + 1))
+        out.write("\n")
+
+    strings = os.path.join(directory, "large_strings.lox")
+    with open(strings, "w") as out:
+        out.write('""')
+        for i in range(8000):
+            out.write(' +\n"line %d of a generated template"' % i)
+        out.write("\n")
+
+    return [arithmetic, strings]
+
+
+def run_once(binary, script, flags):
+    process = subprocess.Popen([binary, "--stats"] + flags + [script], stdout=subprocess.DEVNULL,
+                               stderr=subprocess.PIPE, text=True)
+    stderr = process.stderr.read()
+    process.stderr.close()
+
+    # wait4 gives the rusage of this child alone, RUSAGE_CHILDREN would include the build
+    if hasattr(os, "wait4"):
+        _, status, usage = os.wait4(process.pid, 0)
+        exit_code = os.waitstatus_to_exitcode(status)
+        process.returncode = exit_code
+        max_rss_kb = usage.ru_maxrss // 1024 if sys.platform == "darwin" else usage.ru_maxrss
+    else:
+        exit_code = process.wait()
+        max_rss_kb = None
+
+    lines = stderr.strip().splitlines()
+    if not lines or not lines[-1].startswith("{"):
+        sys.exit("%s exited with %d without reporting stats" % (script, exit_code))
+
+    stats = json.loads(lines[-1])
+    stats["exit_code"] = exit_code
+    stats["max_rss_kb"] = max_rss_kb
+    return stats
+
+
+def measure(binary, script, runs, flags=()):
+    samples = [run_once(binary, script, list(flags)) for _ in range(runs)]
+    first = samples[0]
+
+    result = {
+        "exit_code": first["exit_code"],
+        "source_bytes": first["source_bytes"],
+        "instructions": first["instructions"],
+        "allocations": first["allocations"],
+        "peak_bytes": first["peak_bytes"],
+        "compile_ns": statistics.median(s["compile_ns"] for s in samples),
+        "run_ns": statistics.median(s["run_ns"] for s in samples),
+    }
+
+    result["ops_per_sec"] = result["instructions"] / (result["run_ns"] / 1e9) if result["run_ns"] else None
+    result["compile_mb_per_sec"] = (result["source_bytes"] / 1e6) / (result["compile_ns"] / 1e9) \
+        if result["compile_ns"] else None
+
+    rss = [s["max_rss_kb"] for s in samples if s["max_rss_kb"] is not None]
+    result["max_rss_kb"] = max(rss) if rss else None
+    return result
+
+
+def measure_columnar(binary, runs):
+    samples = []
+    for _ in range(runs):
+        process = subprocess.run([binary], stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, text=True)
+        lines = process.stderr.strip().splitlines()
+        if process.returncode != 0 or not lines or not lines[-1].startswith("{"):
+            sys.exit("columnar exited with %d without reporting stats" % process.returncode)
+        samples.append(json.loads(lines[-1]))
+
+    first = samples[0]
+    result = {
+        "exit_code": 0,
+        "records": first["records"],
+        "column_rows": first["column_rows"],
+        "run_ns": statistics.median(s["run_ns"] for s in samples),
+        "row_by_row_ns": statistics.median(s["row_by_row_ns"] for s in samples),
+    }
+    result["speedup"] = result["row_by_row_ns"] / result["run_ns"] if result["run_ns"] else None
+    return result
+
+
+def compare(results, baseline, time_threshold, count_threshold):
+    regressions = []
+    for name, current in sorted(results.items()):
+        previous = baseline.get(name)
+        if previous is None:
+            print("%-24s new benchmark" % name, file=sys.stderr)
+            continue
+
+        for metric in TIME_METRICS + COUNT_METRICS:
+            old, new = previous.get(metric), current.get(metric)
+            if not old or new is None:
+                continue
+
+            change = (new - old) / old * 100.0
+            threshold = time_threshold if metric in TIME_METRICS else count_threshold
+            flag = "REGRESSION" if change > threshold else ""
+            print("%-24s %-12s %14.0f -> %14.0f  %+7.1f%%  %s" % (name, metric, old, new, change, flag),
+                  file=sys.stderr)
+            if flag:
+                regressions.append((name, metric, change))
+
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--clox", help="use an existing interpreter instead of building one")
+    parser.add_argument("--cc", default=os.environ.get("CC", "cc"), help="C compiler used for the build")
+    parser.add_argument("--runs", type=int, default=10, help="runs per script, the median is reported")
+    parser.add_argument("--save", help="write the JSON report to this file instead of stdout")
+    parser.add_argument("--baseline", help="JSON report to compare against")
+    parser.add_argument("--time-threshold", type=float, default=10.0, help="allowed slowdown in percent")
+    parser.add_argument("--count-threshold", type=float, default=1.0,
+                        help="allowed growth of allocations and peak bytes in percent")
+    parser.add_argument("--no-generated", action="store_true", help="skip the generated large sources")
+    parser.add_argument("--no-columnar", action="store_true", help="skip the runProgramColumns() benchmark")
+    args = parser.parse_args()
+
+    binary = args.clox or build(args.cc)
+    scripts = sorted(glob.glob(os.path.join(BENCH_DIR, "*.lox")))
+    if not args.no_generated:
+        scripts += generate_large_sources()
+
+    results = {}
+    for script in scripts:
+        name = os.path.splitext(os.path.basename(script))[0]
+        results[name] = measure(binary, script, args.runs)
+        results[name + "_unfolded"] = measure(binary, script, args.runs, ["--no-fold"])
+        for entry in (name, name + "_unfolded"):
+            if results[entry]["exit_code"] != 0:
+                print("%s exited with %d" % (entry, results[entry]["exit_code"]), file=sys.stderr)
+
+    if not args.no_columnar:
+        results["columnar"] = measure_columnar(build_columnar(args.cc), args.runs)
+
+    report = json.dumps(results, indent=2, sort_keys=True)
+    if args.save:
+        with open(args.save, "w") as out:
+            out.write(report + "\n")
+    else:
+        print(report)
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        if compare(results, baseline, args.time_threshold, args.count_threshold):
+            sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,65 @@
+// The same program over the same records, once with runProgramColumns() and once with one runProgram()
+// call per record. Built and run by bench.py, which reads the JSON line this prints to stderr
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../CLOX/vm/vm.h"
+#include "../CLOX/vm/columnar.h"
+
+#define RECORDS (1024 * 1024)
+
+static uint64_t nanoTime() {
+	struct timespec time;
+	timespec_get(&time, TIME_UTC);
+	return (uint64_t)time.tv_sec * 1000000000u + (uint64_t)time.tv_nsec;
+}
+
+int main() {
+	VM vm;
+	initVM(&vm);
+
+	const char* names[] = { "price", "quantity", "returned" };
+	Program program;
+	if (!compileProgram(&vm, "price * quantity - price / 2 + 1 > quantity * 100 == !returned", names, 3, &program)) {
+		return 65;
+	}
+
+	Value* inputs = (Value*)malloc(sizeof(Value) * 3 * RECORDS);
+	Value* results = (Value*)malloc(sizeof(Value) * RECORDS);
+	if (inputs == NULL || results == NULL) return 74;
+	for (int i = 0; i < RECORDS; i++) {
+		inputs[i] = NUMBER_VAL((i % 1000) * 0.25);
+		inputs[RECORDS + i] = NUMBER_VAL(i % 17 + 1);
+		inputs[2 * RECORDS + i] = BOOL_VAL(i % 11 == 0);
+	}
+
+	// Touched first, so neither loop pays for faulting in the results
+	memset(results, 0, sizeof(Value) * RECORDS);
+
+	uint64_t start = nanoTime();
+	if (runProgramColumns(&vm, &program, inputs, RECORDS, results) != INTERPRET_OK) return 70;
+	uint64_t columnNanos = nanoTime() - start;
+	int columnRows = vm.stats.columnRows;
+
+	Value record[3];
+	start = nanoTime();
+	for (int i = 0; i < RECORDS; i++) {
+		record[0] = inputs[i];
+		record[1] = inputs[RECORDS + i];
+		record[2] = inputs[2 * RECORDS + i];
+		if (runProgram(&vm, &program, record, &results[i]) != INTERPRET_OK) return 70;
+	}
+	uint64_t rowNanos = nanoTime() - start;
+
+	fprintf(stderr, "{\"records\": %d, \"column_rows\": %d, \"run_ns\": %llu, \"row_by_row_ns\": %llu, \"speedup\": %.2f}\n",
+		RECORDS, columnRows, (unsigned long long)columnNanos, (unsigned long long)rowNanos,
+		columnNanos > 0 ? (double)rowNanos / columnNanos : 0.0);
+
+	free(results);
+	free(inputs);
+	freeProgram(&vm, &program);
+	freeVM(&vm);
+	return 0;
+}
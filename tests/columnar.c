@@ -0,0 +1,175 @@
+// runProgramColumns() against runProgram() row by row - the kernels, and the blocks that fall back to
+// the scalar loop. Built and run by tests/run_tests.py
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../CLOX/vm/vm.h"
+#include "../CLOX/vm/columnar.h"
+#include "../CLOX/objects/objects.h"
+
+#define ROWS (2 * COLUMN_BLOCK + 300) // two whole blocks and a partial one
+
+static int failures = 0;
+
+#define CHECK(condition) \
+		do { \
+			if (!(condition)) { \
+				fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+				failures++; \
+			} \
+		} while (false)
+
+static bool sameValue(VM* vm, Value a, Value b) {
+	// Numbers bit for bit, so 0 and -0 are told apart - except NaNs, whose sign and payload the hardware picks
+	if (IS_NUMBER(a) && IS_NUMBER(b)) {
+		double x = AS_NUMBER(a);
+		double y = AS_NUMBER(b);
+		return memcmp(&x, &y, sizeof(double)) == 0 || (isnan(x) && isnan(y));
+	}
+	if (IS_BOOL(a) && IS_BOOL(b)) return AS_BOOL(a) == AS_BOOL(b);
+	if (IS_NIL(a) && IS_NIL(b)) return true;
+	if (IS_STRING_OR_ROPE(a) && IS_STRING_OR_ROPE(b)) {
+		return strcmp(flattenString(vm, AS_OBJ(a))->chars, flattenString(vm, AS_OBJ(b))->chars) == 0;
+	}
+	return false;
+}
+
+static void compare(VM* vm, const char* source, const char* const* names, const Value* const* columns,
+		int inputCount, int rows, int expectedColumnRows) {
+	// columns are ROWS long - the first rows of each make up the column-major inputs
+	Program program;
+	if (!compileProgram(vm, source, names, inputCount, &program)) {
+		fprintf(stderr, "%s: does not compile\n", source);
+		failures++;
+		return;
+	}
+
+	Value* inputs = (Value*)malloc(sizeof(Value) * (inputCount > 0 ? inputCount : 1) * rows);
+	Value* columnResults = (Value*)malloc(sizeof(Value) * rows);
+	Value* rowResults = (Value*)malloc(sizeof(Value) * rows);
+	for (int i = 0; i < inputCount; i++) memcpy(inputs + (size_t)i * rows, columns[i], sizeof(Value) * rows);
+
+	// Neither side collects, so host strings and every result stay valid until the end
+	InterpretResult columnStatus = runProgramColumns(vm, &program, inputs, rows, columnResults);
+	int columnRows = vm->stats.columnRows;
+
+	InterpretResult rowStatus = INTERPRET_OK;
+	int checkedRows = rows;
+	Value rowInputs[8];
+	for (int row = 0; row < rows; row++) {
+		for (int i = 0; i < inputCount; i++) rowInputs[i] = inputs[(size_t)i * rows + row];
+		rowStatus = runProgramKeepingObjects(vm, &program, rowInputs, &rowResults[row]);
+		if (rowStatus != INTERPRET_OK) {
+			checkedRows = row; // the failing row has no result on either side
+			break;
+		}
+	}
+
+	int mismatches = 0;
+	for (int row = 0; row < checkedRows; row++) {
+		if (sameValue(vm, columnResults[row], rowResults[row])) continue;
+		if (mismatches++ == 0) {
+			fprintf(stderr, "%s: row %d is ", source, row);
+			printValue(vm, columnResults[row]);
+			fprintf(stderr, " in columns but ");
+			printValue(vm, rowResults[row]);
+			fprintf(stderr, " row by row\n");
+		}
+	}
+	if (mismatches > 0 || columnStatus != rowStatus || columnRows != expectedColumnRows) {
+		fprintf(stderr, "%s (%d rows): %d mismatches, status %d/%d, %d rows vectorized where %d were expected\n",
+			source, rows, mismatches, columnStatus, rowStatus, columnRows, expectedColumnRows);
+		failures++;
+	}
+
+	free(rowResults);
+	free(columnResults);
+	free(inputs);
+	freeProgram(vm, &program);
+}
+
+int main() {
+	VM vm;
+	initVM(&vm);
+	vm.output = stderr; // printValue() of mismatching rows
+	FILE* errors = vm.errorOutput;
+	vm.errorOutput = tmpfile(); // the expected runtime errors
+
+	// a has the awkward doubles, b has zeros of both signs to divide by and c is a bool column
+	static Value a[ROWS], b[ROWS], c[ROWS];
+	for (int row = 0; row < ROWS; row++) {
+		switch (row % 9) {
+			case 0:  a[row] = NUMBER_VAL(-0.0); break;
+			case 1:  a[row] = NUMBER_VAL(0.0); break;
+			case 2:  a[row] = NUMBER_VAL(NAN); break;
+			case 3:  a[row] = NUMBER_VAL(INFINITY); break;
+			case 4:  a[row] = NUMBER_VAL(-INFINITY); break;
+			case 5:  a[row] = NUMBER_VAL(4.9e-324); break;
+			default: a[row] = NUMBER_VAL((row - ROWS / 2) * 0.37); break;
+		}
+		b[row] = NUMBER_VAL(row % 13 == 0 ? -0.0 : (double)(row % 5 - 2));
+		c[row] = BOOL_VAL(row % 3 == 0);
+	}
+	const char* names[] = { "a", "b", "c" };
+	const Value* numbers[] = { a, b, c };
+
+	// Everything the kernels handle, so every block is vectorized
+	static const char* vectorized[] = {
+		"a + b * 2 - 1", "a / b", "b / a", "(a - b) * (a + b)", "a * 0", "a + 0", "a - 0", "a * -1",
+		"-a", "0 - a", "-(a * b) / 3 + 4.5 >= b",
+		"a < b", "a > b", "a <= b", "a >= b", "!(a < b)", "!(a > b)", "a == a", "a != a", "a == b", "a != b",
+		"!c", "!!c", "c == (a < b)", "c != true", "!(a > 1) == c", "a == c", "a != c", "!a",
+		"a", "c", "1 + 2", "true",
+	};
+	for (int i = 0; i < (int)(sizeof(vectorized) / sizeof(vectorized[0])); i++) {
+		compare(&vm, vectorized[i], names, numbers, 3, ROWS, ROWS);
+	}
+
+	// Block edges
+	int rowCounts[] = { 1, 2, 3, COLUMN_BLOCK - 1, COLUMN_BLOCK, COLUMN_BLOCK + 1 };
+	for (int i = 0; i < (int)(sizeof(rowCounts) / sizeof(rowCounts[0])); i++) {
+		compare(&vm, "a * b + 1", names, numbers, 2, rowCounts[i], rowCounts[i]);
+	}
+
+	// A bool in the second block of a number column - equality still works there, arithmetic stops
+	// with the runtime error runProgram() gives, after the first block's results
+	static Value mixed[ROWS];
+	memcpy(mixed, a, sizeof(mixed));
+	mixed[COLUMN_BLOCK + 5] = BOOL_VAL(true);
+	const Value* mixedColumns[] = { mixed, b };
+	compare(&vm, "a == b", names, mixedColumns, 2, ROWS, ROWS - COLUMN_BLOCK);
+	compare(&vm, "a != b", names, mixedColumns, 2, ROWS, ROWS - COLUMN_BLOCK);
+	compare(&vm, "a + b", names, mixedColumns, 2, ROWS, COLUMN_BLOCK);
+	compare(&vm, "a + c", names, numbers, 3, ROWS, 0);
+
+	// Strings in the last block only, then in every row
+	static Value someStrings[ROWS], strings[ROWS];
+	memcpy(someStrings, b, sizeof(someStrings));
+	for (int row = 0; row < ROWS; row++) {
+		char text[32];
+		int length = snprintf(text, sizeof(text), "row %d", row % 4);
+		strings[row] = OBJ_VAL(copyString(&vm, text, length));
+		if (row >= 2 * COLUMN_BLOCK) someStrings[row] = strings[row];
+	}
+	const Value* stringColumns[] = { someStrings, strings };
+	compare(&vm, "a == 1", names, stringColumns, 1, ROWS, 2 * COLUMN_BLOCK);
+	compare(&vm, "b + \"!\"", names, stringColumns, 2, ROWS, 0);
+	compare(&vm, "b == \"row 2\"", names, stringColumns, 2, ROWS, 0);
+
+	// Constants and instructions the kernels don't have fall back too
+	compare(&vm, "a == \"text\"", names, numbers, 1, ROWS, 0);
+	compare(&vm, "a != nil", names, numbers, 1, ROWS, 0);
+
+	fclose(vm.errorOutput);
+	vm.errorOutput = errors;
+	freeVM(&vm);
+	CHECK(vm.stats.bytesAllocated == 0);
+
+	if (failures > 0) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,143 @@
+// writeImage() and loadImage() with damaged images - every problem has to end up on vm->errorOutput,
+// where a host or a --jobs worker captures it. Built and run by tests/run_tests.py
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../CLOX/vm/vm.h"
+#include "../CLOX/compiler/compiler.h"
+#include "../CLOX/image/image.h"
+
+#define IMAGE_PATH "image_test.loxc"
+
+// Offsets into the header image.c writes - see ImageHeader
+#define VERSION_OFFSET 4
+#define MAX_STACK_DEPTH_OFFSET 28
+
+static int failures = 0;
+
+#define CHECK(condition) \
+		do { \
+			if (!(condition)) { \
+				fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+				failures++; \
+			} \
+		} while (false)
+
+static void writeSource(VM* vm, const char* source) {
+	Chunk chunk;
+	initChunk(&chunk);
+	CHECK(compile(vm, source, &chunk));
+	CHECK(writeImage(&chunk, IMAGE_PATH, NULL));
+	freeChunk(vm, &chunk);
+}
+
+static void patch(long offset, const void* bytes, size_t length) {
+	FILE* file = fopen(IMAGE_PATH, "r+b");
+	CHECK(file != NULL);
+	if (file == NULL) return;
+	fseek(file, offset, SEEK_SET);
+	fwrite(bytes, 1, length, file);
+	fclose(file);
+}
+
+static long find(const void* bytes, size_t length) {
+	// Offset of the first copy of bytes in the image, -1 if there is none
+	static char contents[4096];
+	FILE* file = fopen(IMAGE_PATH, "rb");
+	if (file == NULL) return -1;
+	size_t size = fread(contents, 1, sizeof(contents), file);
+	fclose(file);
+	for (size_t i = 0; i + length <= size; i++) {
+		if (memcmp(contents + i, bytes, length) == 0) return (long)i;
+	}
+	return -1;
+}
+
+static bool loadReporting(VM* vm, const char* path, const char* expected) {
+	// Loads with errors reported, and checks that the captured output mentions expected
+	FILE* errors = vm->errorOutput;
+	vm->errorOutput = tmpfile();
+
+	Image image;
+	bool loaded = loadImage(vm, path, &image, true, NULL);
+	if (loaded) freeImage(vm, &image);
+
+	char message[512] = { 0 };
+	rewind(vm->errorOutput);
+	size_t length = fread(message, 1, sizeof(message) - 1, vm->errorOutput);
+	message[length] = '\0';
+	fclose(vm->errorOutput);
+	vm->errorOutput = errors;
+
+	if (strstr(message, expected) == NULL) {
+		fprintf(stderr, "%s: expected \"%s\" on errorOutput, got \"%s\"\n", path, expected, message);
+		failures++;
+	}
+	return loaded;
+}
+
+static void testRoundTrip(VM* vm) {
+	writeSource(vm, "1 < 2");
+	Image image;
+	CHECK(loadImage(vm, IMAGE_PATH, &image, true, NULL));
+	FILE* output = vm->output;
+	vm->output = tmpfile(); // interpretChunk() prints the result
+	CHECK(interpretChunk(vm, &image.chunk) == INTERPRET_OK);
+	CHECK(IS_BOOL(vm->result) && AS_BOOL(vm->result));
+	fclose(vm->output);
+	vm->output = output;
+	freeImage(vm, &image);
+}
+
+static void testErrors(VM* vm) {
+	CHECK(!loadReporting(vm, "no_such_image.loxc", "Could not open file \"no_such_image.loxc\"."));
+
+	writeSource(vm, "1 < 2");
+	uint32_t version = IMAGE_VERSION + 1;
+	patch(VERSION_OFFSET, &version, sizeof(version));
+	CHECK(!loadReporting(vm, IMAGE_PATH, "does not match this interpreter"));
+
+	// Passes every bounds check, so only the verifier can tell
+	writeSource(vm, "1 < 2");
+	uint32_t depth = 3;
+	patch(MAX_STACK_DEPTH_OFFSET, &depth, sizeof(depth));
+	CHECK(!loadReporting(vm, IMAGE_PATH, "Invalid bytecode at offset 0: maxStackDepth does not match the code"));
+}
+
+static void testNaNConstants(VM* vm) {
+	// A NaN whose bits spell out an object pointer under NAN_BOXING - loaded as a plain NaN
+	writeSource(vm, "1.5");
+	double number = 1.5;
+	long offset = find(&number, sizeof(number));
+	CHECK(offset > 0);
+	uint64_t bits = 0xfffc000000001234ull;
+	patch(offset, &bits, sizeof(bits));
+
+	Image image;
+	CHECK(loadImage(vm, IMAGE_PATH, &image, true, NULL));
+	CHECK(image.chunk.constants.count == 1);
+	Value constant = image.chunk.constants.values[0];
+	CHECK(IS_NUMBER(constant) && isnan(AS_NUMBER(constant)));
+	freeImage(vm, &image);
+}
+
+int main() {
+	VM vm;
+	initVM(&vm);
+	vm.debug.noFolding = true; // keeps an instruction that needs two stack slots in the image
+
+	testRoundTrip(&vm);
+	testErrors(&vm);
+	testNaNConstants(&vm);
+
+	remove(IMAGE_PATH);
+	freeVM(&vm);
+	CHECK(vm.stats.bytesAllocated == 0);
+
+	if (failures > 0) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,203 @@
+// compileProgram(), runProgram() and freeProgram() as an embedding host uses them.
+// Built and run by tests/run_tests.py
+#include <stdio.h>
+#include <string.h>
+
+#include "../CLOX/vm/vm.h"
+#include "../CLOX/objects/objects.h"
+
+static int failures = 0;
+
+#define CHECK(condition) \
+		do { \
+			if (!(condition)) { \
+				fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+				failures++; \
+			} \
+		} while (false)
+
+static bool isNumber(Value value, double expected) {
+	return IS_NUMBER(value) && AS_NUMBER(value) == expected;
+}
+
+static bool isText(VM* vm, Value value, const char* expected) {
+	// Results of + on strings are often ropes - flattening is fine between runs
+	return IS_STRING_OR_ROPE(value) && strcmp(flattenString(vm, AS_OBJ(value))->chars, expected) == 0;
+}
+
+static Value string(VM* vm, const char* chars) {
+	return OBJ_VAL(copyString(vm, chars, (int)strlen(chars)));
+}
+
+static void testResults(VM* vm) {
+	const char* names[] = { "price", "quantity", "discount" };
+	Program program;
+	CHECK(compileProgram(vm, "price * quantity - discount", names, 3, &program));
+
+	Value inputs[3] = { NUMBER_VAL(2.5), NUMBER_VAL(4), NUMBER_VAL(1) };
+	Value result;
+	CHECK(runProgram(vm, &program, inputs, &result) == INTERPRET_OK);
+	CHECK(isNumber(result, 9));
+
+	// Inputs can be used more than once, in any order, or not at all
+	Program reordered;
+	CHECK(compileProgram(vm, "discount + discount > price", names, 3, &reordered));
+	CHECK(runProgram(vm, &reordered, inputs, &result) == INTERPRET_OK);
+	CHECK(IS_BOOL(result) && !AS_BOOL(result));
+
+	freeProgram(vm, &reordered);
+	freeProgram(vm, &program);
+}
+
+static void testReuse(VM* vm) {
+	// One compile, many runs - every run sees only its own inputs
+	const char* names[] = { "x", "y" };
+	Program program;
+	CHECK(compileProgram(vm, "(x - y) * (x + y)", names, 2, &program));
+
+	for (int i = 0; i < 1000; i++) {
+		Value inputs[2] = { NUMBER_VAL(i), NUMBER_VAL(i % 7) };
+		Value result;
+		CHECK(runProgram(vm, &program, inputs, &result) == INTERPRET_OK);
+		CHECK(isNumber(result, (double)(i - i % 7) * (i + i % 7)));
+	}
+
+	// Strings, with a result fed back in as the next run's input
+	const char* label[] = { "name" };
+	Program greet;
+	CHECK(compileProgram(vm, "name + \", hello\"", label, 1, &greet));
+	Value name = string(vm, "Ada");
+	CHECK(runProgram(vm, &greet, &name, &name) == INTERPRET_OK);
+	CHECK(runProgram(vm, &greet, &name, &name) == INTERPRET_OK);
+	CHECK(isText(vm, name, "Ada, hello, hello"));
+
+	// A runtime error ends that run only - the program still works for the next record
+	Value wrong[2] = { string(vm, "seven"), NUMBER_VAL(1) };
+	Value result = NIL_VAL;
+	FILE* errors = vm->errorOutput;
+	vm->errorOutput = tmpfile();
+	CHECK(runProgram(vm, &program, wrong, &result) == INTERPRET_RUNTIME_ERROR);
+	fclose(vm->errorOutput);
+	vm->errorOutput = errors;
+
+	Value inputs[2] = { NUMBER_VAL(5), NUMBER_VAL(3) };
+	CHECK(runProgram(vm, &program, inputs, &result) == INTERPRET_OK);
+	CHECK(isNumber(result, 16));
+
+	freeProgram(vm, &greet);
+	freeProgram(vm, &program);
+}
+
+static void testUndefinedInput(VM* vm) {
+	const char* names[] = { "price" };
+	Program program;
+
+	FILE* errors = vm->errorOutput;
+	vm->errorOutput = tmpfile();
+	CHECK(!compileProgram(vm, "price * tax", names, 1, &program));
+
+	char message[256] = { 0 };
+	rewind(vm->errorOutput);
+	size_t length = fread(message, 1, sizeof(message) - 1, vm->errorOutput);
+	message[length] = '\0';
+	CHECK(strstr(message, "at 'tax': Undefined input.") != NULL);
+	fclose(vm->errorOutput);
+	vm->errorOutput = errors;
+
+	// Nothing of the failed compile is left pinned
+	CHECK(vm->pinned.count == 0);
+}
+
+static void testLiteralChain(VM* vm) {
+	// A long chain of literals is folded into one constant - through a rope, so compiling it takes memory
+	// in proportion to the text rather than to the square of it
+	enum { PIECES = 4000 };
+	static char source[PIECES * 24];
+	static char expected[PIECES * 24];
+	int sourceLength = 0;
+	int expectedLength = 0;
+	for (int i = 0; i < PIECES; i++) {
+		sourceLength += sprintf(source + sourceLength, "%s\"piece %05d;\"", i == 0 ? "" : " + ", i);
+		expectedLength += sprintf(expected + expectedLength, "piece %05d;", i);
+	}
+
+	size_t before = vm->stats.bytesAllocated;
+	Program program;
+	CHECK(compileProgram(vm, source, NULL, 0, &program));
+	CHECK(vm->stats.bytesAllocated - before < (size_t)expectedLength * 16);
+
+	Value result;
+	CHECK(runProgram(vm, &program, NULL, &result) == INTERPRET_OK);
+	CHECK(isText(vm, result, expected));
+	freeProgram(vm, &program);
+}
+
+static size_t settle(VM* vm, Program* probe) {
+	// With stressGC every run starts with a full collection, which first applies the sweep of the one
+	// before. The last result stays a root until a run replaces it, so it takes three runs of the probe -
+	// which makes no objects - until everything unreachable has been freed and counted
+	Value input = NUMBER_VAL(0);
+	Value result;
+	for (int i = 0; i < 3; i++) runProgram(vm, probe, &input, &result);
+	return vm->stats.bytesAllocated;
+}
+
+static void cycle(VM* vm, int round) {
+	// A program with string constants and string results, compiled, run and freed again. Every round
+	// makes strings no earlier round had
+	const char* names[] = { "first", "last" };
+	Program program;
+	CHECK(compileProgram(vm, "first + \" \" + last + \" (customer record)\"", names, 2, &program));
+
+	for (int i = 0; i < 50; i++) {
+		char number[32];
+		snprintf(number, sizeof(number), "%d-%d", round, i);
+		Value inputs[2] = { string(vm, "Grace"), string(vm, number) };
+		Value result;
+		CHECK(runProgram(vm, &program, inputs, &result) == INTERPRET_OK);
+
+		char expected[64];
+		snprintf(expected, sizeof(expected), "Grace %s (customer record)", number);
+		CHECK(isText(vm, result, expected));
+	}
+	freeProgram(vm, &program);
+}
+
+static void testMemory(VM* vm) {
+	// Collecting all the time keeps the live set, and so the size of the intern table, the same
+	// from one round to the next - otherwise the table would grow with the garbage between collections
+	vm->debug.stressGC = true;
+	const char* names[] = { "x" };
+	Program probe;
+	CHECK(compileProgram(vm, "x", names, 1, &probe));
+
+	// The first round grows the buffers the VM keeps - the nursery, the intern table, the pinned array
+	cycle(vm, 0);
+	size_t start = settle(vm, &probe);
+
+	for (int round = 1; round <= 20; round++) cycle(vm, round);
+	CHECK(settle(vm, &probe) == start);
+
+	freeProgram(vm, &probe);
+	vm->debug.stressGC = false;
+}
+
+int main() {
+	VM vm;
+	initVM(&vm);
+
+	testResults(&vm);
+	testReuse(&vm);
+	testUndefinedInput(&vm);
+	testLiteralChain(&vm);
+	testMemory(&vm);
+
+	freeVM(&vm);
+	CHECK(vm.stats.bytesAllocated == 0);
+
+	if (failures > 0) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	return 0;
+}
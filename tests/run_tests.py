@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+"""Builds and runs the embedding tests.
+
+Every .c file in tests/ is a program of its own that links the interpreter
+without its main.c, runs its checks and exits with 0 when they all pass. They
+run in tests/build, where any files they write go.
+
+    python3 tests/run_tests.py
+    python3 tests/run_tests.py --cc clang --cflags="-fsanitize=address,undefined"
+"""
+
+import argparse
+import glob
+import os
+import shlex
+import subprocess
+import sys
+
+TESTS_DIR = os.path.dirname(os.path.abspath(__file__))
+SOURCE_DIR = os.path.join(TESTS_DIR, "..", "CLOX")
+BUILD_DIR = os.path.join(TESTS_DIR, "build")
+
+
+def interpreter_sources():
+    sources = sorted(glob.glob(os.path.join(SOURCE_DIR, "**", "*.c"), recursive=True))
+    return [source for source in sources if os.path.basename(source) != "main.c"]
+
+
+def build(compiler, cflags, test):
+    os.makedirs(BUILD_DIR, exist_ok=True)
+    binary = os.path.join(BUILD_DIR, os.path.splitext(os.path.basename(test))[0])
+    command = [compiler, "-std=c17", "-O2", "-g"] + shlex.split(cflags) + ["-o", binary, test] + \
+        interpreter_sources() + ["-lm", "-lpthread"]
+    subprocess.run(command, check=True)
+    return binary
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--cc", default=os.environ.get("CC", "cc"), help="C compiler used for the build")
+    parser.add_argument("--cflags", default="", help="extra compiler flags, such as sanitizers")
+    parser.add_argument("tests", nargs="*", help="test sources to run, every tests/*.c by default")
+    args = parser.parse_args()
+
+    tests = args.tests or sorted(glob.glob(os.path.join(TESTS_DIR, "*.c")))
+    failed = []
+    for test in tests:
+        name = os.path.splitext(os.path.basename(test))[0]
+        exit_code = subprocess.run([build(args.cc, args.cflags, test)], cwd=BUILD_DIR).returncode
+        print("%-24s %s" % (name, "ok" if exit_code == 0 else "FAILED (exit %d)" % exit_code), file=sys.stderr)
+        if exit_code != 0:
+            failed.append(name)
+
+    if failed:
+        sys.exit("%d of %d tests failed" % (len(failed), len(tests)))
+
+
+if __name__ == "__main__":
+    main()